@@ -0,0 +1,688 @@
+#ifndef BINARY_HPP
+#define BINARY_HPP
+
+#include "file.hpp"
+#include "section.hpp"
+#include "value.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+// Binary format, all numbers in the byte order of the machine that wrote it:
+//
+//   header    magic "DCFB", version, byte order mark, the root section's offset and
+//             entry count, offset of the string table
+//   sections  an index size, the entries in insertion order and an open addressing
+//             index of the entries by key hash, empty for small sections
+//   arrays    a value slot per element
+//   strings   all keys, headers and string values, each stored once
+//
+// Every value is a 16 byte slot holding the type, a length and either the value itself
+// or the offset of its string, array or section. Sections and arrays are always stored
+// after the slot referring to them, so following offsets can never loop.
+
+namespace dcf {
+    class BinaryArray;
+    class BinarySection;
+
+    namespace internal {
+        class BinaryWriter;
+
+        constexpr char BINARY_MAGIC[4] = {'D', 'C', 'F', 'B'};
+        constexpr uint32_t BINARY_VERSION = 1;
+        constexpr uint32_t BINARY_BYTE_ORDER = 0x01020304;
+        // Sections and arrays are copied out recursively, so their nesting is limited. Deeper
+        // than text could ever be parsed with the default options.
+        constexpr size_t BINARY_MAX_DEPTH = 1024;
+
+        struct BinaryHeader {
+            char magic[4];
+            uint32_t version;
+            uint32_t byteOrder;
+            uint32_t rootLength;
+            uint64_t size;
+            uint64_t root;
+            uint64_t strings;
+            uint64_t stringsSize;
+        };
+
+        struct BinarySlot {
+            uint8_t type;
+            uint8_t reserved[3];
+            // Length of a string, number of elements of an array or entries of a section
+            uint32_t length;
+            // The value itself, or the offset of a string in the string table or of an
+            // array or section in the data
+            uint64_t payload;
+        };
+
+        struct BinaryEntry {
+            uint64_t key;
+            uint32_t keyLength;
+            uint32_t hash;
+            uint64_t header;
+            uint32_t headerLength;
+            uint32_t reserved;
+            BinarySlot value;
+        };
+
+        static_assert(sizeof(BinaryHeader) == 48 && sizeof(BinarySlot) == 16 && sizeof(BinaryEntry) == 48,
+            "Unexpected padding in the binary format");
+
+        // Stored in the files, so unlike the hash of dcf::Key it must never change
+        inline uint32_t binaryHash(std::string_view key) {
+            uint32_t hash = 2166136261u;
+            for(const char c : key) {
+                hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+            }
+            return hash;
+        }
+
+        // Reads a structure from any offset, the data may not be aligned for it
+        template<typename T>
+        T readBinary(std::string_view data, uint64_t offset, uint64_t count = 1) {
+            if(offset > data.size() || count > (data.size() - offset) / sizeof(T)) {
+                throw std::runtime_error("Corrupt binary DCF data");
+            }
+            T value;
+            std::memcpy(&value, data.data() + offset, sizeof(T));
+            return value;
+        }
+
+
+        class BinaryWriter {
+        public:
+            std::string write(const dcf::Section &section);
+
+        private:
+            // Sections up to this size are searched linearly, like dcf::Section
+            static constexpr size_t LINEAR_SCAN_LIMIT = 8;
+
+            std::string data;
+            std::string strings;
+            std::unordered_map<std::string_view, uint64_t> stringOffsets;
+
+            uint64_t allocate(size_t size);
+            uint64_t addString(std::string_view text);
+            BinarySlot writeValue(const dcf::Value &value);
+            BinarySlot writeSection(const dcf::Section &section);
+            BinarySlot writeArray(const dcf::Value::Array &array);
+        };
+    } // namespace internal
+
+
+    // A value inside binary DCF data. Only valid as long as the dcf::BinaryDocument lives.
+    class BinaryValue {
+    public:
+        ValueType getType() const;
+
+        std::string_view asString() const;
+        bool asBool() const;
+        int64_t asInt() const;
+        double asDouble() const;
+        BinaryArray asArray() const;
+        BinarySection asSection() const;
+
+        // Copies the value out of the binary data
+        Value toValue(const Value::allocator_type &allocator = {}) const;
+
+    private:
+        friend class BinaryArray;
+        friend class BinarySection;
+
+        std::string_view data;
+        std::string_view strings;
+        internal::BinarySlot slot;
+        // Offset of the slot itself, everything it refers to has to come after it
+        uint64_t offset;
+
+        BinaryValue(std::string_view data, std::string_view strings, uint64_t offset);
+
+        void checkType(ValueType expected) const;
+        uint64_t child(size_t elementSize) const;
+        Value toValue(const Value::allocator_type &allocator, size_t depth) const;
+    };
+
+
+    class BinaryArray {
+    public:
+        size_t size() const;
+        BinaryValue operator[](size_t index) const;
+
+    private:
+        friend class BinaryValue;
+
+        std::string_view data;
+        std::string_view strings;
+        uint64_t offset;
+        size_t count;
+
+        BinaryArray(std::string_view data, std::string_view strings, uint64_t offset, size_t count);
+    };
+
+
+    class BinarySection {
+    public:
+        size_t size() const;
+        BinaryValue get(std::string_view key) const;
+        std::optional<BinaryValue> find(std::string_view key) const;
+        std::vector<std::string> keys() const;
+        std::string getHeader(std::string_view key) const;
+
+        // Copies the whole section out of the binary data
+        Section toSection(const Section::allocator_type &allocator = {}) const;
+
+    private:
+        friend class BinaryValue;
+        friend class BinaryDocument;
+
+        static constexpr size_t NOT_FOUND = static_cast<size_t>(-1);
+
+        std::string_view data;
+        std::string_view strings;
+        uint64_t offset;
+        size_t count;
+        size_t indexSize;
+
+        BinarySection(std::string_view data, std::string_view strings, uint64_t offset, size_t count);
+
+        internal::BinaryEntry entry(size_t position) const;
+        std::string_view key(const internal::BinaryEntry &entry) const;
+        size_t locate(std::string_view key) const;
+        Section toSection(const Section::allocator_type &allocator, size_t depth) const;
+    };
+
+
+    // Binary DCF data, usually a memory mapped file. Values are read straight from the
+    // data when they are accessed, nothing is decoded up front.
+    class BinaryDocument {
+    public:
+        BinarySection root() const;
+
+    private:
+        friend BinaryDocument loadBinary(std::string_view data);
+        friend BinaryDocument loadBinaryFile(const std::string &path);
+
+        std::shared_ptr<const void> owner;
+        std::string_view data;
+        std::string_view strings;
+        uint64_t rootOffset;
+        size_t rootCount;
+
+        BinaryDocument(std::shared_ptr<const void> owner, std::string_view data);
+    };
+
+
+    // Encodes the section in the binary format, to be loaded with dcf::loadBinaryFile
+    inline std::string toBinary(const Section &section) {
+        return internal::BinaryWriter().write(section);
+    }
+
+    // Loads a copy of the binary data
+    inline BinaryDocument loadBinary(std::string_view data) {
+        const auto copy = std::make_shared<const std::string>(data);
+        return BinaryDocument(copy, *copy);
+    }
+
+    // Maps the file and reads values from the mapping as they are accessed
+    inline BinaryDocument loadBinaryFile(const std::string &path) {
+        const auto file = std::make_shared<const internal::MappedFile>(path, false);
+        return BinaryDocument(file, file->text());
+    }
+} // namespace dcf
+
+
+
+inline std::string dcf::internal::BinaryWriter::write(const dcf::Section &section) {
+    data.assign(sizeof(BinaryHeader), '\0');
+    const BinarySlot root = writeSection(section);
+
+    BinaryHeader header = {};
+    std::memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+    header.version = BINARY_VERSION;
+    header.byteOrder = BINARY_BYTE_ORDER;
+    header.root = root.payload;
+    header.rootLength = root.length;
+    header.strings = allocate(strings.size());
+    header.stringsSize = strings.size();
+    header.size = data.size();
+    std::memcpy(data.data() + header.strings, strings.data(), strings.size());
+    std::memcpy(data.data(), &header, sizeof(header));
+
+    return std::move(data);
+}
+
+
+// Appends zeroed space aligned to eight bytes and returns its offset
+inline uint64_t dcf::internal::BinaryWriter::allocate(size_t size) {
+    const size_t offset = (data.size() + 7) & ~static_cast<size_t>(7);
+    data.resize(offset + size, '\0');
+    return offset;
+}
+
+
+inline uint64_t dcf::internal::BinaryWriter::addString(std::string_view text) {
+    if(text.size() > UINT32_MAX) {
+        throw std::runtime_error("String is too long for the binary format");
+    }
+    const auto [found, inserted] = stringOffsets.try_emplace(text, strings.size());
+    if(inserted) {
+        strings += text;
+    }
+    return found->second;
+}
+
+
+inline dcf::internal::BinarySlot dcf::internal::BinaryWriter::writeValue(const dcf::Value &value) {
+    BinarySlot slot = {};
+    slot.type = static_cast<uint8_t>(value.getType());
+
+    switch(value.getType()) {
+        case dcf::ValueType::STRING:
+            slot.payload = addString(value.asString());
+            slot.length = static_cast<uint32_t>(value.asString().size());
+            break;
+        case dcf::ValueType::BOOLEAN:
+            slot.payload = value.asBool() ? 1 : 0;
+            break;
+        case dcf::ValueType::INTEGER: {
+            const int64_t num = value.asInt();
+            std::memcpy(&slot.payload, &num, sizeof(num));
+            break;
+        }
+        case dcf::ValueType::DOUBLE: {
+            const double num = value.asDouble();
+            std::memcpy(&slot.payload, &num, sizeof(num));
+            break;
+        }
+        case dcf::ValueType::ARRAY:
+            return writeArray(value.arrayContents());
+        case dcf::ValueType::SECTION:
+            return writeSection(value.asSection());
+    }
+    return slot;
+}
+
+
+inline dcf::internal::BinarySlot dcf::internal::BinaryWriter::writeSection(const dcf::Section &section) {
+    const size_t count = section.read().entries.size() - section.read().removedCount;
+    if(count > UINT32_MAX / 4) {
+        throw std::runtime_error("Section is too large for the binary format");
+    }
+    size_t indexSize = 0;
+    if(count > LINEAR_SCAN_LIMIT) {
+        indexSize = 16;
+        while(indexSize < count * 2) {
+            indexSize *= 2;
+        }
+    }
+
+    // The block is filled in once the values have been written, which may move the data
+    const uint64_t offset = allocate(sizeof(uint64_t) + count * sizeof(BinaryEntry) + indexSize * sizeof(uint32_t));
+    std::vector<BinaryEntry> entries;
+    entries.reserve(count);
+    for(const dcf::Section::Entry &source : section.read().entries) {
+        if(source.removed) {
+            continue;
+        }
+        if(source.header.size() > UINT32_MAX) {
+            throw std::runtime_error("String is too long for the binary format");
+        }
+        BinaryEntry entry = {};
+        entry.key = addString(source.key);
+        entry.keyLength = static_cast<uint32_t>(source.key.size());
+        entry.hash = binaryHash(source.key);
+        entry.header = addString(source.header);
+        entry.headerLength = static_cast<uint32_t>(source.header.size());
+        entry.value = writeValue(source.value);
+        entries.push_back(entry);
+    }
+
+    std::vector<uint32_t> index(indexSize, 0);
+    for(size_t i = 0; indexSize != 0 && i < count; i++) {
+        size_t slot = entries[i].hash & (indexSize - 1);
+        while(index[slot] != 0) {
+            slot = (slot + 1) & (indexSize - 1);
+        }
+        index[slot] = static_cast<uint32_t>(i + 1);
+    }
+
+    const uint64_t indexSize64 = indexSize;
+    char *block = data.data() + offset;
+    std::memcpy(block, &indexSize64, sizeof(indexSize64));
+    if(count != 0) {
+        std::memcpy(block + sizeof(uint64_t), entries.data(), count * sizeof(BinaryEntry));
+    }
+    if(indexSize != 0) {
+        std::memcpy(block + sizeof(uint64_t) + count * sizeof(BinaryEntry), index.data(), indexSize * sizeof(uint32_t));
+    }
+
+    BinarySlot slot = {};
+    slot.type = static_cast<uint8_t>(dcf::ValueType::SECTION);
+    slot.length = static_cast<uint32_t>(count);
+    slot.payload = offset;
+    return slot;
+}
+
+
+inline dcf::internal::BinarySlot dcf::internal::BinaryWriter::writeArray(const dcf::Value::Array &array) {
+    if(array.size() > UINT32_MAX) {
+        throw std::runtime_error("Array is too large for the binary format");
+    }
+
+    const uint64_t offset = allocate(array.size() * sizeof(BinarySlot));
+    size_t i = 0;
+    array.forEach([this, offset, &i](const dcf::Value &value) {
+        const BinarySlot element = writeValue(value);
+        std::memcpy(data.data() + offset + i++ * sizeof(BinarySlot), &element, sizeof(element));
+    });
+
+    BinarySlot slot = {};
+    slot.type = static_cast<uint8_t>(dcf::ValueType::ARRAY);
+    slot.length = static_cast<uint32_t>(array.size());
+    slot.payload = offset;
+    return slot;
+}
+
+
+
+inline dcf::BinaryValue::BinaryValue(std::string_view data, std::string_view strings, uint64_t offset)
+    : data(data), strings(strings), slot(internal::readBinary<internal::BinarySlot>(data, offset)), offset(offset) {
+    if(slot.type > static_cast<uint8_t>(ValueType::SECTION)) {
+        throw std::runtime_error("Corrupt binary DCF data");
+    }
+}
+
+
+inline dcf::ValueType dcf::BinaryValue::getType() const {
+    return static_cast<ValueType>(slot.type);
+}
+
+
+inline std::string_view dcf::BinaryValue::asString() const {
+    checkType(ValueType::STRING);
+    if(slot.payload > strings.size() || slot.length > strings.size() - slot.payload) {
+        throw std::runtime_error("Corrupt binary DCF data");
+    }
+    return strings.substr(slot.payload, slot.length);
+}
+
+
+inline bool dcf::BinaryValue::asBool() const {
+    checkType(ValueType::BOOLEAN);
+    return slot.payload != 0;
+}
+
+
+inline int64_t dcf::BinaryValue::asInt() const {
+    checkType(ValueType::INTEGER);
+    int64_t num;
+    std::memcpy(&num, &slot.payload, sizeof(num));
+    return num;
+}
+
+
+inline double dcf::BinaryValue::asDouble() const {
+    checkType(ValueType::DOUBLE);
+    double num;
+    std::memcpy(&num, &slot.payload, sizeof(num));
+    return num;
+}
+
+
+inline dcf::BinaryArray dcf::BinaryValue::asArray() const {
+    checkType(ValueType::ARRAY);
+    return BinaryArray(data, strings, child(sizeof(internal::BinarySlot)), slot.length);
+}
+
+
+inline dcf::BinarySection dcf::BinaryValue::asSection() const {
+    checkType(ValueType::SECTION);
+    return BinarySection(data, strings, child(sizeof(internal::BinaryEntry)), slot.length);
+}
+
+
+inline dcf::Value dcf::BinaryValue::toValue(const Value::allocator_type &allocator) const {
+    return toValue(allocator, 1);
+}
+
+
+inline void dcf::BinaryValue::checkType(ValueType expected) const {
+    if(getType() != expected) {
+        throw std::runtime_error("Type mismatch");
+    }
+}
+
+
+// Offset of the array or section the slot refers to, checked to lie after the slot
+// and to have room for its elements
+inline uint64_t dcf::BinaryValue::child(size_t elementSize) const {
+    if(slot.payload <= offset || slot.payload > data.size() || slot.length > (data.size() - slot.payload) / elementSize) {
+        throw std::runtime_error("Corrupt binary DCF data");
+    }
+    return slot.payload;
+}
+
+
+inline dcf::Value dcf::BinaryValue::toValue(const Value::allocator_type &allocator, size_t depth) const {
+    if(depth > internal::BINARY_MAX_DEPTH) {
+        throw std::runtime_error("Binary DCF data is nested too deeply");
+    }
+
+    switch(getType()) {
+        case ValueType::STRING:
+            return Value(asString(), allocator);
+        case ValueType::BOOLEAN:
+            return Value(asBool(), allocator);
+        case ValueType::INTEGER:
+            return Value(asInt(), allocator);
+        case ValueType::DOUBLE:
+            return Value(asDouble(), allocator);
+        case ValueType::ARRAY: {
+            const BinaryArray array = asArray();
+            std::pmr::vector<Value> values(allocator);
+            values.reserve(array.size());
+            for(size_t i = 0; i < array.size(); i++) {
+                values.push_back(array[i].toValue(allocator, depth + 1));
+            }
+            return Value(std::move(values), allocator);
+        }
+        case ValueType::SECTION:
+            return Value(asSection().toSection(allocator, depth + 1), allocator);
+    }
+    throw std::runtime_error("Corrupt binary DCF data");
+}
+
+
+
+inline dcf::BinaryArray::BinaryArray(std::string_view data, std::string_view strings, uint64_t offset, size_t count)
+    : data(data), strings(strings), offset(offset), count(count) { }
+
+
+inline size_t dcf::BinaryArray::size() const {
+    return count;
+}
+
+
+inline dcf::BinaryValue dcf::BinaryArray::operator[](size_t index) const {
+    if(index >= count) {
+        throw std::out_of_range("Array index out of range");
+    }
+    return BinaryValue(data, strings, offset + index * sizeof(internal::BinarySlot));
+}
+
+
+
+inline dcf::BinarySection::BinarySection(std::string_view data, std::string_view strings, uint64_t offset, size_t count)
+    : data(data), strings(strings), offset(offset), count(count) {
+    const uint64_t size = internal::readBinary<uint64_t>(data, offset);
+    if(count != 0) {
+        internal::readBinary<internal::BinaryEntry>(data, offset + sizeof(uint64_t), count);
+    }
+    // Index sizes are powers of two with room to spare for all entries
+    if(size != 0) {
+        if((size & (size - 1)) != 0 || size <= count) {
+            throw std::runtime_error("Corrupt binary DCF data");
+        }
+        internal::readBinary<uint32_t>(data, offset + sizeof(uint64_t) + count * sizeof(internal::BinaryEntry), size);
+    }
+    indexSize = static_cast<size_t>(size);
+}
+
+
+inline size_t dcf::BinarySection::size() const {
+    return count;
+}
+
+
+inline dcf::BinaryValue dcf::BinarySection::get(std::string_view key) const {
+    const size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        throw std::runtime_error("Key not found: " + std::string(key));
+    }
+    return BinaryValue(data, strings, offset + sizeof(uint64_t) + position * sizeof(internal::BinaryEntry) + offsetof(internal::BinaryEntry, value));
+}
+
+
+inline std::optional<dcf::BinaryValue> dcf::BinarySection::find(std::string_view key) const {
+    const size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        return std::nullopt;
+    }
+    return BinaryValue(data, strings, offset + sizeof(uint64_t) + position * sizeof(internal::BinaryEntry) + offsetof(internal::BinaryEntry, value));
+}
+
+
+inline std::vector<std::string> dcf::BinarySection::keys() const {
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for(size_t i = 0; i < count; i++) {
+        keys.emplace_back(key(entry(i)));
+    }
+    return keys;
+}
+
+
+inline std::string dcf::BinarySection::getHeader(std::string_view key) const {
+    const size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        throw std::runtime_error("Key not found: " + std::string(key));
+    }
+    const internal::BinaryEntry found = entry(position);
+    if(found.header > strings.size() || found.headerLength > strings.size() - found.header) {
+        throw std::runtime_error("Corrupt binary DCF data");
+    }
+    return std::string(strings.substr(found.header, found.headerLength));
+}
+
+
+inline dcf::Section dcf::BinarySection::toSection(const Section::allocator_type &allocator) const {
+    return toSection(allocator, 1);
+}
+
+
+inline dcf::internal::BinaryEntry dcf::BinarySection::entry(size_t position) const {
+    return internal::readBinary<internal::BinaryEntry>(data, offset + sizeof(uint64_t) + position * sizeof(internal::BinaryEntry));
+}
+
+
+inline std::string_view dcf::BinarySection::key(const internal::BinaryEntry &entry) const {
+    if(entry.key > strings.size() || entry.keyLength > strings.size() - entry.key) {
+        throw std::runtime_error("Corrupt binary DCF data");
+    }
+    return strings.substr(entry.key, entry.keyLength);
+}
+
+
+inline size_t dcf::BinarySection::locate(std::string_view key) const {
+    if(indexSize == 0) {
+        for(size_t i = 0; i < count; i++) {
+            const internal::BinaryEntry current = entry(i);
+            if(current.keyLength == key.size() && this->key(current) == key) {
+                return i;
+            }
+        }
+        return NOT_FOUND;
+    }
+
+    const uint32_t hash = internal::binaryHash(key);
+    const uint64_t index = offset + sizeof(uint64_t) + count * sizeof(internal::BinaryEntry);
+    const size_t mask = indexSize - 1;
+    // The index always has free slots, the bound only matters for corrupt data
+    size_t slot = hash & mask;
+    for(size_t probes = 0; probes < indexSize; probes++, slot = (slot + 1) & mask) {
+        const uint32_t position = internal::readBinary<uint32_t>(data, index + slot * sizeof(uint32_t));
+        if(position == 0) {
+            break;
+        }
+        if(position > count) {
+            throw std::runtime_error("Corrupt binary DCF data");
+        }
+        const internal::BinaryEntry current = entry(position - 1);
+        if(current.hash == hash && current.keyLength == key.size() && this->key(current) == key) {
+            return position - 1;
+        }
+    }
+    return NOT_FOUND;
+}
+
+
+inline dcf::Section dcf::BinarySection::toSection(const Section::allocator_type &allocator, size_t depth) const {
+    if(depth > internal::BINARY_MAX_DEPTH) {
+        throw std::runtime_error("Binary DCF data is nested too deeply");
+    }
+
+    Section section(allocator);
+    for(size_t i = 0; i < count; i++) {
+        const internal::BinaryEntry current = entry(i);
+        const std::string_view name = key(current);
+        const BinaryValue value(data, strings, offset + sizeof(uint64_t) + i * sizeof(internal::BinaryEntry) + offsetof(internal::BinaryEntry, value));
+        section.set(name, value.toValue(allocator, depth));
+        if(current.headerLength != 0) {
+            section.setHeader(name, getHeader(name));
+        }
+    }
+    return section;
+}
+
+
+
+inline dcf::BinaryDocument::BinaryDocument(std::shared_ptr<const void> owner, std::string_view data)
+    : owner(std::move(owner)), data(data) {
+    const internal::BinaryHeader header = internal::readBinary<internal::BinaryHeader>(data, 0);
+    if(std::memcmp(header.magic, internal::BINARY_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("Not binary DCF data");
+    }
+    if(header.byteOrder != internal::BINARY_BYTE_ORDER) {
+        throw std::runtime_error("Binary DCF data was written with a different byte order");
+    }
+    if(header.version != internal::BINARY_VERSION) {
+        throw std::runtime_error("Unsupported binary DCF version: " + std::to_string(header.version));
+    }
+    if(header.size != data.size() || header.strings > data.size() || header.stringsSize > data.size() - header.strings) {
+        throw std::runtime_error("Corrupt binary DCF data");
+    }
+    strings = data.substr(header.strings, header.stringsSize);
+
+    // The root is stored like any other section, just without a slot referring to it
+    if(header.root < sizeof(header)) {
+        throw std::runtime_error("Corrupt binary DCF data");
+    }
+    rootOffset = header.root;
+    rootCount = header.rootLength;
+}
+
+
+inline dcf::BinarySection dcf::BinaryDocument::root() const {
+    return BinarySection(data, strings, rootOffset, rootCount);
+}
+
+#endif // BINARY_HPP
@@ -0,0 +1,461 @@
+#ifndef BINDING_HPP
+#define BINDING_HPP
+
+#include "file.hpp"
+#include "handler.hpp"
+#include "lexer.hpp"
+#include "options.hpp"
+#include "parser.hpp"
+#include "writer.hpp"
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Binds the listed members of a struct to the keys of the same name, so it can be read
+// with dcf::parseAs and written with dcf::toString. Use it in the namespace of the struct,
+// for up to 32 members. Members may be bools, integers, floating point numbers,
+// std::strings, bound structs, and std::vectors and std::optionals of these.
+// Function calls are not evaluated in bound structs, reading one into any member is a
+// dcf::parse_error, while pairs with keys that are not bound may still hold them.
+//
+//     struct Server { std::string host; int port; std::vector<std::string> aliases; };
+//     DCF_BIND(Server, host, port, aliases)
+#define DCF_BIND(Type, ...) \
+    inline constexpr auto dcfBinding(const Type*) { \
+        return std::make_tuple(DCF_INTERNAL_CONCAT(DCF_INTERNAL_FIELDS_, DCF_INTERNAL_COUNT(__VA_ARGS__))(Type, __VA_ARGS__)); \
+    }
+
+#define DCF_INTERNAL_CONCAT(a, b) DCF_INTERNAL_CONCAT_EXPANDED(a, b)
+#define DCF_INTERNAL_CONCAT_EXPANDED(a, b) a##b
+
+#define DCF_INTERNAL_COUNT(...) DCF_INTERNAL_COUNT_ARGUMENTS(__VA_ARGS__, \
+    32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, \
+    16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DCF_INTERNAL_COUNT_ARGUMENTS( \
+    _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, \
+    _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, count, ...) count
+
+#define DCF_INTERNAL_FIELD(Type, member) ::dcf::internal::makeField(#member, &Type::member)
+#define DCF_INTERNAL_FIELDS_1(Type, a) DCF_INTERNAL_FIELD(Type, a)
+#define DCF_INTERNAL_FIELDS_2(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_1(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_3(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_2(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_4(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_3(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_5(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_4(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_6(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_5(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_7(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_6(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_8(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_7(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_9(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_8(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_10(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_9(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_11(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_10(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_12(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_11(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_13(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_12(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_14(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_13(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_15(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_14(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_16(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_15(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_17(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_16(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_18(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_17(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_19(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_18(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_20(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_19(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_21(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_20(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_22(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_21(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_23(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_22(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_24(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_23(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_25(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_24(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_26(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_25(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_27(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_26(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_28(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_27(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_29(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_28(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_30(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_29(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_31(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_30(Type, __VA_ARGS__)
+#define DCF_INTERNAL_FIELDS_32(Type, a, ...) DCF_INTERNAL_FIELD(Type, a), DCF_INTERNAL_FIELDS_31(Type, __VA_ARGS__)
+
+
+namespace dcf::internal {
+
+    template<typename Struct, typename Member>
+    struct Field {
+        std::string_view name;
+        Member Struct::*member;
+    };
+
+    template<typename Struct, typename Member>
+    constexpr Field<Struct, Member> makeField(std::string_view name, Member Struct::*member) {
+        return {name, member};
+    }
+
+
+    // The fields of a struct bound with DCF_BIND, found through argument dependent lookup
+    template<typename T>
+    constexpr auto fieldsOf() {
+        return dcfBinding(static_cast<const T*>(nullptr));
+    }
+
+    template<typename T, typename = void>
+    struct IsBound : std::false_type { };
+    template<typename T>
+    struct IsBound<T, std::void_t<decltype(dcfBinding(static_cast<const T*>(nullptr)))>> : std::true_type { };
+
+    template<typename T>
+    struct IsVector : std::false_type { };
+    template<typename T, typename Allocator>
+    struct IsVector<std::vector<T, Allocator>> : std::true_type { };
+
+    template<typename T>
+    struct IsOptional : std::false_type { };
+    template<typename T>
+    struct IsOptional<std::optional<T>> : std::true_type { };
+
+
+    // Reads bound structs straight from the tokens, without building any sections. Keys are
+    // dispatched to the fields by comparing them against the compile-time field names,
+    // values of unknown keys are checked against the grammar and skipped.
+    class BindingReader : private ParserBase {
+    public:
+        BindingReader(Lexer &lexer, const dcf::ParseOptions &options = {});
+
+        template<typename T>
+        void parse(T &object);
+
+    private:
+        // Sections and arrays currently open
+        size_t depth = 0;
+
+        template<typename T>
+        void read(T &value);
+        template<typename T>
+        void readSection(T &object);
+        template<typename T, size_t... I>
+        bool readField(T &object, std::string_view key, std::index_sequence<I...>);
+        template<typename T>
+        void readVector(T &vector);
+        template<typename T>
+        void readInteger(T &value);
+        template<typename T>
+        void readFloatingPoint(T &value);
+
+        void skipValue();
+        bool takeComma();
+        void open();
+    };
+
+
+    // Writes bound structs in the same layout dcf::Section::toString uses
+    class BindingWriter : private Writer {
+    public:
+        BindingWriter(std::string &buffer, const dcf::WriteOptions &options);
+
+        template<typename T>
+        void write(const T &object);
+
+    private:
+        template<typename T>
+        void writeValue(const T &value, int depth);
+        template<typename T>
+        void writeSection(const T &object, int depth);
+        template<typename T, size_t... I>
+        void writeFields(const T &object, int depth, size_t remaining, std::index_sequence<I...>);
+        template<typename T>
+        void writeField(std::string_view name, const T &value, int depth, size_t &remaining);
+        template<typename T>
+        void writeArray(const T &array, int depth);
+
+        template<typename T>
+        static bool isPresent(const T &value);
+    };
+} // namespace dcf::internal
+
+
+namespace dcf {
+    // Reads the text into the bound struct. Members whose keys are missing keep their values,
+    // pairs with keys that are not bound are skipped.
+    template<typename T>
+    void parseInto(std::string_view text, T &object, const ParseOptions &options = {}) {
+        internal::Lexer lexer(text);
+        internal::BindingReader(lexer, options).parse(object);
+    }
+
+    template<typename T>
+    T parseAs(std::string_view text, const ParseOptions &options = {}) {
+        T object{};
+        parseInto(text, object, options);
+        return object;
+    }
+
+    template<typename T>
+    T parseFileAs(const std::string &path, const ParseOptions &options = {}) {
+        internal::MappedFile file(path);
+        return parseAs<T>(file.text(), options);
+    }
+
+    // Writes the bound struct as a section, empty optionals are left out.
+    // Only takes part in overload resolution for types bound with DCF_BIND.
+    template<typename T, typename = std::enable_if_t<internal::IsBound<T>::value>>
+    void write(std::string &buffer, const T &object, const WriteOptions &options = {}) {
+        internal::BindingWriter(buffer, options).write(object);
+    }
+
+    template<typename T, typename = std::enable_if_t<internal::IsBound<T>::value>>
+    std::string toString(const T &object, const WriteOptions &options = {}) {
+        std::string text;
+        write(text, object, options);
+        return text;
+    }
+} // namespace dcf
+
+
+
+inline dcf::internal::BindingReader::BindingReader(Lexer &lexer, const dcf::ParseOptions &options)
+    : ParserBase(lexer, options) { }
+
+
+template<typename T>
+void dcf::internal::BindingReader::parse(T &object) {
+    static_assert(IsBound<T>::value, "The type has to be bound with DCF_BIND");
+    readSection(object);
+    matchNextNoComments(Token::Type::END_OF_INPUT);
+}
+
+
+template<typename T>
+void dcf::internal::BindingReader::read(T &value) {
+    if constexpr(std::is_same_v<T, bool>) {
+        value = cleanBooleanTokenValue(matchNextNoComments(Token::Type::BOOLEAN));
+    } else if constexpr(std::is_integral_v<T>) {
+        readInteger(value);
+    } else if constexpr(std::is_floating_point_v<T>) {
+        readFloatingPoint(value);
+    } else if constexpr(std::is_same_v<T, std::string>) {
+        value = cleanStringTokenValue(matchNextNoComments(Token::Type::STRING));
+    } else if constexpr(IsOptional<T>::value) {
+        read(value.emplace());
+    } else if constexpr(IsVector<T>::value) {
+        readVector(value);
+    } else {
+        static_assert(IsBound<T>::value, "Member type cannot be read, bind it with DCF_BIND");
+        readSection(value);
+    }
+}
+
+
+template<typename T>
+void dcf::internal::BindingReader::readSection(T &object) {
+    constexpr size_t fieldCount = std::tuple_size_v<decltype(fieldsOf<T>())>;
+
+    matchNextNoComments(Token::Type::L_BRACE);
+    open();
+    while(nextWillMatchNoComments(Token::Type::KEY)) {
+        const std::string_view key = matchNextNoComments(Token::Type::KEY).value;
+        matchNextNoComments(Token::Type::COLON);
+        if(!readField(object, key, std::make_index_sequence<fieldCount>())) {
+            skipValue();
+        }
+        if(!takeComma()) {
+            break;
+        }
+    }
+    matchNextNoComments(Token::Type::R_BRACE);
+    depth--;
+}
+
+
+// Reads the value into the field with the key as its name, returns false if there is none
+template<typename T, size_t... I>
+bool dcf::internal::BindingReader::readField(T &object, std::string_view key, std::index_sequence<I...>) {
+    constexpr auto fields = fieldsOf<T>();
+    return ((key == std::get<I>(fields).name && (read(object.*(std::get<I>(fields).member)), true)) || ...);
+}
+
+
+template<typename T>
+void dcf::internal::BindingReader::readVector(T &vector) {
+    matchNextNoComments(Token::Type::L_BRACKET);
+    open();
+    vector.clear();
+    while(!nextWillMatchNoComments(Token::Type::R_BRACKET)) {
+        // Read into a copy of its own, elements of std::vector<bool> cannot be referenced
+        typename T::value_type element{};
+        read(element);
+        vector.push_back(std::move(element));
+        if(!takeComma()) {
+            break;
+        }
+    }
+    matchNextNoComments(Token::Type::R_BRACKET);
+    depth--;
+}
+
+
+template<typename T>
+void dcf::internal::BindingReader::readInteger(T &value) {
+    const Token &token = nextNoComments();
+    if(token.type != Token::Type::NUM_INT && token.type != Token::Type::NUM_HEX && token.type != Token::Type::NUM_BINARY) {
+        error("integer");
+    }
+
+    const int64_t num = cleanIntegerTokenValue(token);
+    bool fits;
+    if constexpr(std::is_signed_v<T>) {
+        fits = num >= std::numeric_limits<T>::min() && num <= std::numeric_limits<T>::max();
+    } else {
+        fits = num >= 0 && static_cast<uint64_t>(num) <= std::numeric_limits<T>::max();
+    }
+    if(!fits) {
+        throw dcf::parse_error("Number out of range", token.line, token.column);
+    }
+    value = static_cast<T>(num);
+}
+
+
+// Integers are taken as well, there is no telling 1 and 1.0 apart in a floating point member
+template<typename T>
+void dcf::internal::BindingReader::readFloatingPoint(T &value) {
+    const Token &token = nextNoComments();
+    if(token.type == Token::Type::NUM_DECIMAL) {
+        value = static_cast<T>(cleanDoubleTokenValue(token));
+    } else if(token.type == Token::Type::NUM_INT || token.type == Token::Type::NUM_HEX || token.type == Token::Type::NUM_BINARY) {
+        value = static_cast<T>(cleanIntegerTokenValue(token));
+    } else {
+        error("number");
+    }
+}
+
+
+inline void dcf::internal::BindingReader::skipValue() {
+    dcf::ParseOptions skipOptions = options;
+    skipOptions.maxDepth -= depth;
+    dcf::Handler ignore;
+    EventParser(lexer, ignore, skipOptions).parseNextValue();
+}
+
+
+inline bool dcf::internal::BindingReader::takeComma() {
+    if(!nextWillMatchNoComments(Token::Type::COMMA)) {
+        return false;
+    }
+    nextNoComments();
+    return true;
+}
+
+
+inline void dcf::internal::BindingReader::open() {
+    if(depth >= options.maxDepth) {
+        throw dcf::parse_error("Nesting is deeper than " + std::to_string(options.maxDepth) + " levels", current.line, current.column);
+    }
+    depth++;
+}
+
+
+
+inline dcf::internal::BindingWriter::BindingWriter(std::string &buffer, const dcf::WriteOptions &options)
+    : Writer(buffer, options) { }
+
+
+template<typename T>
+void dcf::internal::BindingWriter::write(const T &object) {
+    static_assert(IsBound<T>::value, "The type has to be bound with DCF_BIND");
+    writeSection(object, 1);
+}
+
+
+template<typename T>
+void dcf::internal::BindingWriter::writeValue(const T &value, int depth) {
+    if constexpr(std::is_same_v<T, bool>) {
+        buffer += value ? "true" : "false";
+    } else if constexpr(std::is_integral_v<T>) {
+        if constexpr(std::is_unsigned_v<T> && sizeof(T) >= sizeof(int64_t)) {
+            if(value > static_cast<uint64_t>(INT64_MAX)) {
+                throw std::range_error("Integer is too large to be written: " + std::to_string(value));
+            }
+        }
+        writeInteger(buffer, static_cast<int64_t>(value));
+    } else if constexpr(std::is_floating_point_v<T>) {
+        writeDouble(buffer, static_cast<double>(value));
+    } else if constexpr(std::is_same_v<T, std::string>) {
+        buffer += '"';
+        buffer += value;
+        buffer += '"';
+    } else if constexpr(IsOptional<T>::value) {
+        writeValue(*value, depth);
+    } else if constexpr(IsVector<T>::value) {
+        writeArray(value, depth);
+    } else {
+        static_assert(IsBound<T>::value, "Member type cannot be written, bind it with DCF_BIND");
+        writeSection(value, depth);
+    }
+}
+
+
+template<typename T>
+void dcf::internal::BindingWriter::writeSection(const T &object, int depth) {
+    constexpr auto fields = fieldsOf<T>();
+    constexpr size_t fieldCount = std::tuple_size_v<decltype(fields)>;
+
+    // Needed up front to know which pair is the last one
+    size_t remaining = std::apply([&object](const auto&... field) {
+        return (size_t(0) + ... + (isPresent(object.*(field.member)) ? 1 : 0));
+    }, fields);
+    if(remaining == 0) {
+        buffer += "{}";
+        return;
+    }
+
+    open('{');
+    writeFields(object, depth, remaining, std::make_index_sequence<fieldCount>());
+    close('}', depth);
+}
+
+
+template<typename T, size_t... I>
+void dcf::internal::BindingWriter::writeFields(const T &object, int depth, size_t remaining, std::index_sequence<I...>) {
+    constexpr auto fields = fieldsOf<T>();
+    (writeField(std::get<I>(fields).name, object.*(std::get<I>(fields).member), depth, remaining), ...);
+}
+
+
+template<typename T>
+void dcf::internal::BindingWriter::writeField(std::string_view name, const T &value, int depth, size_t &remaining) {
+    if(!isPresent(value)) {
+        return;
+    }
+    writeKey(name, depth);
+    writeValue(value, depth + 1);
+    writeSeparator(--remaining == 0);
+}
+
+
+template<typename T>
+void dcf::internal::BindingWriter::writeArray(const T &array, int depth) {
+    if(array.empty()) {
+        buffer += "[]";
+        return;
+    }
+
+    open('[');
+    for(size_t i = 0; i < array.size(); i++) {
+        writeIndent(depth);
+        writeValue(static_cast<const typename T::value_type&>(array[i]), depth + 1);
+        writeSeparator(i + 1 == array.size());
+    }
+    close(']', depth);
+}
+
+
+template<typename T>
+bool dcf::internal::BindingWriter::isPresent(const T &value) {
+    if constexpr(IsOptional<T>::value) {
+        return value.has_value();
+    } else {
+        (void) value;
+        return true;
+    }
+}
+
+#endif // BINDING_HPP
@@ -1,10 +1,24 @@
 #ifndef DCF_HPP
 #define DCF_HPP
 
+#include "binary.hpp"
+#include "binding.hpp"
+#include "diff.hpp"
+#include "document.hpp"
+#include "file.hpp"
+#include "function.hpp"
+#include "handler.hpp"
+#include "incremental.hpp"
+#include "key.hpp"
+#include "lazy.hpp"
+#include "live.hpp"
 #include "parser.hpp"
+#include "path.hpp"
 #include "section.hpp"
 #include "lexer.hpp"
+#include "options.hpp"
 #include "value.hpp"
+#include "writer.hpp"
 
 
 static_assert(sizeof(double) == 8,
@@ -13,18 +27,36 @@ static_assert(sizeof(double) == 8,
 
 
 namespace dcf {
-    dcf::Section parse(const std::string &text) {
-        std::vector<internal::Token> tokens;
-        tokenize(text, tokens);
+    inline dcf::Section parse(std::string_view text, const ParseOptions &options = {}) {
+        if(options.lazy) {
+            // Lazily parsed values need the text for as long as they live
+            const auto copy = std::make_shared<const std::string>(text);
+            return internal::parseText(*copy, copy, options);
+        }
+        return internal::parseText(text, nullptr, options);
+    }
 
-        if(tokens.size() == 0) {
-            throw parse_error("Expected content in input but got nothing");
+    // Parses the file straight from a read-only memory mapping of it
+    inline dcf::Section parseFile(const std::string &path, const ParseOptions &options = {}) {
+        if(options.lazy) {
+            // Lazily parsed values keep the file mapped
+            const auto file = std::make_shared<const internal::MappedFile>(path);
+            return internal::parseText(file->text(), file, options);
         }
+        internal::MappedFile file(path);
+        return internal::parseText(file.text(), nullptr, options);
+    }
 
-        internal::Token lastToken = tokens.back();
-        tokens.emplace_back(internal::Token::Type::END_OF_INPUT, "", lastToken.line, lastToken.column + lastToken.value.length());
+    // Hands the document to the handler as it is parsed, of the options only the depth
+    // limit applies
+    inline void parse(std::string_view text, Handler &handler, const ParseOptions &options = {}) {
+        internal::Lexer lexer(text);
+        internal::EventParser(lexer, handler, options).parse();
+    }
 
-        return internal::Parser(tokens).parse();
+    inline void parseFile(const std::string &path, Handler &handler, const ParseOptions &options = {}) {
+        internal::MappedFile file(path);
+        parse(file.text(), handler, options);
     }
 } // namespace dcf
 
@@ -0,0 +1,349 @@
+#ifndef DIFF_HPP
+#define DIFF_HPP
+
+#include "lazy.hpp"
+#include "path.hpp"
+#include "section.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace dcf {
+    // One change to a section. Paths take the form dcf::Path takes them, without wildcards,
+    // as in "a.b[3].c".
+    struct PatchOperation {
+        enum class Kind {
+            // Adds a key to a section at the given position, replacing the key if it is there
+            SET,
+            // Removes a key from a section
+            REMOVE,
+            // Changes the value of a key or of an element of an array
+            REPLACE,
+            // Changes the header of a key
+            HEADER
+        };
+
+        Kind kind;
+        std::string path;
+        // False for REMOVE and HEADER. Always in the default memory resource, so a patch can
+        // be kept and sent on after the sections it was made from are gone.
+        Value value;
+        // For SET and HEADER
+        std::string header{};
+        // For SET, the position of the key among the keys of its section once it is added.
+        // Keys that would come after all others go to the end.
+        size_t position = 0;
+    };
+
+    using Patch = std::vector<PatchOperation>;
+
+    // The operations that turn the first section into the second one, headers and the order
+    // of the keys included. Sections on both sides are compared key by key and arrays of the
+    // same length element by element, all else that changed is replaced as a whole. Keys
+    // that have moved are removed and set again in their new place. Subtrees shared between
+    // both sides are not compared at all.
+    Patch diff(const Section &before, const Section &after);
+
+    // Applies the operations in order. Only the sections and arrays on the paths of the
+    // operations are copied, and only if they are shared with other copies. Throws if a
+    // path doesn't lead anywhere, the operations before it have been applied then.
+    void apply(Section &section, const Patch &patch);
+} // namespace dcf
+
+
+namespace dcf::internal {
+    class Patcher {
+    public:
+        static void diff(const dcf::Section &before, const dcf::Section &after, std::string &path, dcf::Patch &patch);
+        static void diff(const dcf::Value &before, const dcf::Value &after, std::string &path, dcf::Patch &patch);
+        static void apply(dcf::Section &root, const dcf::PatchOperation &operation);
+
+    private:
+        using allocator_type = dcf::Section::allocator_type;
+        using Step = dcf::Path::Step;
+
+        static dcf::Value& follow(dcf::Section &root, const std::vector<Step> &steps, const std::string &path);
+        static dcf::Value& entry(dcf::Section &section, const Step &step, const std::string &path);
+        static void place(dcf::Section &section, std::string_view key, size_t position);
+        static dcf::Section& writeSection(dcf::Value &value, const allocator_type &allocator);
+        static dcf::Value::Array& writeArray(dcf::Value &value, const allocator_type &allocator);
+        static dcf::Value plain(const dcf::Value &value);
+        static std::string& appendKey(std::string &path, size_t length, std::string_view key);
+        static std::string& appendIndex(std::string &path, size_t length, size_t index);
+    };
+} // namespace dcf::internal
+
+
+
+inline dcf::Patch dcf::diff(const Section &before, const Section &after) {
+    Patch patch;
+    std::string path;
+    internal::Patcher::diff(before, after, path, patch);
+    return patch;
+}
+
+
+inline void dcf::apply(Section &section, const Patch &patch) {
+    for(const PatchOperation &operation : patch) {
+        internal::Patcher::apply(section, operation);
+    }
+}
+
+
+
+// Equal sections can still differ in their headers and the order of their keys, so only
+// shared ones are skipped. The keys of the second section that come in the order they had in
+// the first one stay where they are, the others are removed and set again. Taking each key
+// that comes after the last one kept doesn't always keep the most keys, but keys are rarely
+// moved and when they are this keeps most of them.
+inline void dcf::internal::Patcher::diff(const dcf::Section &before, const dcf::Section &after,
+    std::string &path, dcf::Patch &patch) {
+    if(before.contents == after.contents) {
+        return;
+    }
+
+    const auto &entries = before.read().entries;
+    const auto &others = after.read().entries;
+    std::vector<size_t> keptAt(entries.size(), dcf::Section::NOT_FOUND);
+    std::vector<bool> kept(others.size(), false);
+    size_t next = 0;
+    for(size_t i = 0; i < others.size(); i++) {
+        if(others[i].removed) {
+            continue;
+        }
+        const size_t position = before.locate(others[i].key, others[i].hash);
+        if(position != dcf::Section::NOT_FOUND && position >= next) {
+            keptAt[position] = i;
+            kept[i] = true;
+            next = position + 1;
+        }
+    }
+
+    const size_t length = path.size();
+    for(size_t i = 0; i < entries.size(); i++) {
+        const dcf::Section::Entry &entry = entries[i];
+        if(entry.removed) {
+            continue;
+        }
+        if(keptAt[i] == dcf::Section::NOT_FOUND) {
+            patch.push_back({dcf::PatchOperation::Kind::REMOVE, appendKey(path, length, entry.key), dcf::Value(false)});
+            continue;
+        }
+        const dcf::Section::Entry &other = others[keptAt[i]];
+        if(entry.header != other.header) {
+            patch.push_back({dcf::PatchOperation::Kind::HEADER, appendKey(path, length, entry.key), dcf::Value(false), std::string(other.header)});
+        }
+        diff(entry.value, other.value, appendKey(path, length, entry.key), patch);
+    }
+
+    size_t position = 0;
+    for(size_t i = 0; i < others.size(); i++) {
+        if(others[i].removed) {
+            continue;
+        }
+        if(!kept[i]) {
+            patch.push_back({dcf::PatchOperation::Kind::SET, appendKey(path, length, others[i].key), plain(others[i].value),
+                std::string(others[i].header), position});
+        }
+        position++;
+    }
+    path.resize(length);
+}
+
+
+// Sections in arrays can differ in their headers only, so arrays of the same length are
+// compared element by element even if they are equal
+inline void dcf::internal::Patcher::diff(const dcf::Value &before, const dcf::Value &after,
+    std::string &path, dcf::Patch &patch) {
+    if(before.getType() == after.getType() && before.getType() == dcf::ValueType::SECTION) {
+        diff(before.asSection(), after.asSection(), path, patch);
+        return;
+    }
+
+    if(before.getType() == after.getType() && before.getType() == dcf::ValueType::ARRAY
+        && before.arrayContents().size() == after.arrayContents().size()) {
+        const dcf::Value::Array &elements = before.arrayContents();
+        const dcf::Value::Array &others = after.arrayContents();
+        if(&elements == &others || ((elements.packed.index() != 0 || others.packed.index() != 0) && before == after)) {
+            return;
+        }
+        dcf::Value element(false);
+        dcf::Value other(false);
+        const size_t length = path.size();
+        for(size_t i = 0; i < elements.size(); i++) {
+            diff(elements.at(i, element), others.at(i, other), appendIndex(path, length, i), patch);
+        }
+        path.resize(length);
+        return;
+    }
+    if(before != after) {
+        patch.push_back({dcf::PatchOperation::Kind::REPLACE, path, plain(after)});
+    }
+}
+
+
+// Changes are made in the section or array the path leads to, after everything on the way
+// there has been made this section's alone
+inline void dcf::internal::Patcher::apply(dcf::Section &root, const dcf::PatchOperation &operation) {
+    const dcf::Path parsed(operation.path);
+    if(parsed.hasWildcards) {
+        throw std::runtime_error("No value at path " + operation.path);
+    }
+    const Step &last = parsed.steps.back();
+
+    dcf::Section *section = &root;
+    if(parsed.steps.size() > 1) {
+        dcf::Value &parent = follow(root, parsed.steps, operation.path);
+        if(last.kind == Step::Kind::INDEX && parent.getType() == dcf::ValueType::ARRAY) {
+            dcf::Value::Array &array = writeArray(parent, root.allocator);
+            if(operation.kind != dcf::PatchOperation::Kind::REPLACE) {
+                throw std::runtime_error("Elements of arrays can only be replaced: " + operation.path);
+            }
+            if(last.index >= array.size()) {
+                throw std::runtime_error("No value at path " + operation.path);
+            }
+            array.set(last.index, dcf::Value(operation.value, array.elements.get_allocator()));
+            return;
+        }
+        if(last.kind != Step::Kind::KEY || parent.getType() != dcf::ValueType::SECTION) {
+            throw std::runtime_error("No value at path " + operation.path);
+        }
+        section = &writeSection(parent, root.allocator);
+    }
+
+    const std::string_view key = last.key.name();
+    switch(operation.kind) {
+        case dcf::PatchOperation::Kind::SET:
+            if(section->find(key) != nullptr) {
+                section->remove(key);
+            }
+            section->set(key, operation.value);
+            section->setHeader(key, operation.header);
+            place(*section, key, operation.position);
+            break;
+
+        case dcf::PatchOperation::Kind::REPLACE:
+            section->set(key, operation.value);
+            break;
+
+        case dcf::PatchOperation::Kind::REMOVE:
+            section->remove(key);
+            break;
+
+        case dcf::PatchOperation::Kind::HEADER:
+            section->setHeader(key, operation.header);
+            break;
+    }
+}
+
+
+// The value all but the last step lead to, with the sections and arrays on the way made
+// this root's alone
+inline dcf::Value& dcf::internal::Patcher::follow(dcf::Section &root, const std::vector<Step> &steps, const std::string &path) {
+    dcf::Value *value = &entry(root, steps[0], path);
+    for(size_t i = 1; i + 1 < steps.size(); i++) {
+        const Step &step = steps[i];
+        if(step.kind == Step::Kind::INDEX && value->getType() == dcf::ValueType::ARRAY) {
+            dcf::Value::Array &array = writeArray(*value, root.allocator);
+            // Packed elements are neither sections nor arrays, there is nothing to change below them
+            if(array.packed.index() != 0 || step.index >= array.size()) {
+                throw std::runtime_error("No value at path " + path);
+            }
+            value = &array.elements[step.index];
+        } else if(step.kind == Step::Kind::KEY && value->getType() == dcf::ValueType::SECTION) {
+            value = &entry(writeSection(*value, root.allocator), step, path);
+        } else {
+            throw std::runtime_error("No value at path " + path);
+        }
+    }
+    return *value;
+}
+
+
+inline dcf::Value& dcf::internal::Patcher::entry(dcf::Section &section, const Step &step, const std::string &path) {
+    const size_t position = section.locate(step.key.name());
+    if(position == dcf::Section::NOT_FOUND) {
+        throw std::runtime_error("No value at path " + path);
+    }
+    return section.write().entries[position].value;
+}
+
+
+// Moves the entry of the key back to the position among the keys, it comes after all that
+// are already there
+inline void dcf::internal::Patcher::place(dcf::Section &section, std::string_view key, size_t position) {
+    const size_t from = section.locate(key);
+    auto &entries = section.write().entries;
+    size_t to = 0;
+    for(size_t live = 0; to < from && (entries[to].removed || live < position); to++) {
+        if(!entries[to].removed) {
+            live++;
+        }
+    }
+    if(to < from) {
+        std::rotate(entries.begin() + static_cast<std::ptrdiff_t>(to), entries.begin() + static_cast<std::ptrdiff_t>(from),
+            entries.begin() + static_cast<std::ptrdiff_t>(from) + 1);
+        section.rebuildIndex();
+    }
+}
+
+
+// Values share their sections with their copies, the section is copied first if it is
+// shared. That copy shares the contents in turn until they are written to.
+inline dcf::Section& dcf::internal::Patcher::writeSection(dcf::Value &value, const allocator_type &allocator) {
+    if(auto lazy = std::get_if<std::shared_ptr<const internal::LazyValue>>(&value.data)) {
+        value = dcf::Value(internal::resolve(**lazy), allocator);
+    }
+    auto &section = std::get<std::shared_ptr<dcf::Section>>(value.data);
+    if(section.use_count() > 1) {
+        section = allocateShared<dcf::Section>(allocator, *section, allocator);
+    }
+    return *section;
+}
+
+
+inline dcf::Value::Array& dcf::internal::Patcher::writeArray(dcf::Value &value, const allocator_type &allocator) {
+    if(auto lazy = std::get_if<std::shared_ptr<const internal::LazyValue>>(&value.data)) {
+        value = dcf::Value(internal::resolve(**lazy), allocator);
+    }
+    auto &array = std::get<std::shared_ptr<dcf::Value::Array>>(value.data);
+    if(array.use_count() > 1) {
+        array = dcf::Value::copyArray(allocator, *array);
+    }
+    array->fingerprint.store(0, std::memory_order_relaxed);
+    return *array;
+}
+
+
+// A copy in the default memory resource, which is deep if the value is in another one,
+// like the arena of a dcf::Document
+inline dcf::Value dcf::internal::Patcher::plain(const dcf::Value &value) {
+    return dcf::Value(value, allocator_type());
+}
+
+
+// Cuts the path back to the given length and appends the key or index to it
+inline std::string& dcf::internal::Patcher::appendKey(std::string &path, size_t length, std::string_view key) {
+    path.resize(length);
+    if(length > 0) {
+        path += '.';
+    }
+    path += key;
+    return path;
+}
+
+
+inline std::string& dcf::internal::Patcher::appendIndex(std::string &path, size_t length, size_t index) {
+    path.resize(length);
+    path += '[';
+    path += std::to_string(index);
+    path += ']';
+    return path;
+}
+
+#endif // DIFF_HPP
@@ -0,0 +1,67 @@
+#ifndef DOCUMENT_HPP
+#define DOCUMENT_HPP
+
+#include "options.hpp"
+#include "parser.hpp"
+#include "section.hpp"
+#include <memory_resource>
+
+
+namespace dcf {
+    // A parsed document whose sections, arrays, values and keys all live in one monotonic
+    // arena owned by the document. Allocation is a pointer bump and everything is released
+    // at once when the document is destroyed. Only string values longer than what a
+    // std::string holds inline are allocated on their own, Value::asString hands them out
+    // as std::strings.
+    // References to sections and values in the document must not outlive it, but copies of
+    // them into another memory resource, like Section copy(doc.root()), are copied deeply.
+    class Document {
+    public:
+        Document(std::string_view text, const ParseOptions &options = {});
+
+        Document(const Document&) = delete;
+        Document& operator=(const Document&) = delete;
+
+        Section& root();
+        const Section& root() const;
+
+    private:
+        std::pmr::monotonic_buffer_resource arena;
+        Section rootSection;
+
+        Section parse(std::string_view text, const ParseOptions &options);
+    };
+} // namespace dcf
+
+
+
+inline dcf::Document::Document(std::string_view text, const ParseOptions &options)
+    // The parsed document takes about as much memory as its text, so one initial block
+    // of that size holds most documents entirely
+    : arena(std::max<size_t>(text.size(), 1024)), rootSection(parse(text, options)) { }
+
+
+inline dcf::Section& dcf::Document::root() {
+    return rootSection;
+}
+
+
+inline const dcf::Section& dcf::Document::root() const {
+    return rootSection;
+}
+
+
+inline dcf::Section dcf::Document::parse(std::string_view text, const ParseOptions &options) {
+    // The arena is not thread safe, so documents are always parsed on one thread
+    ParseOptions documentOptions = options;
+    documentOptions.threads = 1;
+
+    if(options.lazy) {
+        // Lazily parsed values need the text for as long as the document lives
+        const auto copy = std::make_shared<const std::string>(text);
+        return internal::parseText(*copy, copy, documentOptions, &arena);
+    }
+    return internal::parseText(text, nullptr, documentOptions, &arena);
+}
+
+#endif // DOCUMENT_HPP
@@ -0,0 +1,130 @@
+#ifndef FILE_HPP
+#define FILE_HPP
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define DCF_MMAP
+#endif
+
+
+namespace dcf::internal {
+
+    // Read-only view of a whole file. Regular files are memory mapped where the platform
+    // supports it, everything else (pipes, empty files, failed mappings) is read into memory.
+    // Sequential mappings are read ahead aggressively, which suits parsing text but not
+    // looking up single values.
+    class MappedFile {
+    public:
+        MappedFile(const std::string &path, bool sequential = true);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        std::string_view text() const;
+
+    private:
+        const char *mapping = nullptr;
+        size_t mappingSize = 0;
+        std::string buffer;
+
+#ifdef DCF_MMAP
+        void read(int fd, const std::string &path);
+#else
+        void read(const std::string &path);
+#endif
+    };
+} // namespace dcf::internal
+
+
+
+inline dcf::internal::MappedFile::MappedFile(const std::string &path, bool sequential) {
+#ifdef DCF_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error("Unable to open file: " + path);
+    }
+
+    struct stat info;
+    if(::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *address = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if(address != MAP_FAILED) {
+            mapping = static_cast<const char*>(address);
+            mappingSize = static_cast<size_t>(info.st_size);
+            if(sequential) {
+                ::madvise(address, mappingSize, MADV_SEQUENTIAL);
+            }
+        }
+    }
+
+    // Read from the descriptor already open, opening a pipe again would wait for another writer
+    if(mapping == nullptr) {
+        try {
+            read(fd, path);
+        } catch(...) {
+            ::close(fd);
+            throw;
+        }
+    }
+    ::close(fd);
+#else
+    read(path);
+#endif
+}
+
+
+inline dcf::internal::MappedFile::~MappedFile() {
+#ifdef DCF_MMAP
+    if(mapping != nullptr) {
+        ::munmap(const_cast<char*>(mapping), mappingSize);
+    }
+#endif
+}
+
+
+inline std::string_view dcf::internal::MappedFile::text() const {
+    if(mapping != nullptr) {
+        return std::string_view(mapping, mappingSize);
+    }
+    return buffer;
+}
+
+
+#ifdef DCF_MMAP
+inline void dcf::internal::MappedFile::read(int fd, const std::string &path) {
+    char chunk[64 * 1024];
+    while(true) {
+        const ssize_t length = ::read(fd, chunk, sizeof(chunk));
+        if(length > 0) {
+            buffer.append(chunk, static_cast<size_t>(length));
+        } else if(length == 0) {
+            return;
+        } else if(errno != EINTR) {
+            throw std::runtime_error("Unable to read file: " + path);
+        }
+    }
+}
+#else
+inline void dcf::internal::MappedFile::read(const std::string &path) {
+    std::ifstream fileStream(path, std::ios::binary);
+    if(!fileStream.is_open()) {
+        throw std::runtime_error("Unable to open file: " + path);
+    }
+
+    std::ostringstream content;
+    content << fileStream.rdbuf();
+    buffer = content.str();
+}
+#endif
+
+#endif // FILE_HPP
@@ -0,0 +1,433 @@
+#ifndef FUNCTION_HPP
+#define FUNCTION_HPP
+
+#include "lazy.hpp"
+#include "lexer.hpp"
+#include "options.hpp"
+#include "section.hpp"
+#include "value.hpp"
+#include "writer.hpp"
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace dcf {
+    // Gets the evaluated arguments of a call. Functions may be called from several threads
+    // at once when a document is parsed on several threads.
+    using Function = std::function<Value(const std::pmr::vector<Value> &arguments)>;
+
+    // The functions documents may call. @this is part of the grammar and always there:
+    // @this("a.b.0") stands for a copy of the value at that path from the root section,
+    // with keys of sections and indices of arrays separated by dots.
+    class FunctionRegistry {
+    public:
+        // Comes with the built-in functions, @concat joins strings, booleans and numbers
+        FunctionRegistry();
+
+        // Replaces any function of the same name
+        void add(std::string_view name, Function function);
+        const Function* find(std::string_view name) const;
+
+        static const FunctionRegistry& builtins();
+
+    private:
+        std::unordered_map<std::string, Function> functions;
+    };
+} // namespace dcf
+
+
+namespace dcf::internal {
+
+    // A function call as parsed, kept in its value until the document is evaluated
+    struct FunctionCall {
+        using allocator_type = dcf::Value::allocator_type;
+
+        // Without the leading '@'
+        std::pmr::string name;
+        std::pmr::vector<dcf::Value> arguments;
+        size_t line;
+        size_t column;
+
+        FunctionCall(std::string_view name, std::pmr::vector<dcf::Value> &&arguments,
+            size_t line, size_t column, const allocator_type &allocator);
+    };
+
+
+    // Replaces every function call of a parsed document with its result. Calls depend on
+    // their arguments and on what they refer to, sections and arrays on the calls in them.
+    // Together they form a graph that is evaluated level by level in topological order,
+    // so each call is evaluated exactly once, after everything it needs, and a value that
+    // is referred to many times is computed only once. Calls on the same level don't depend
+    // on each other and are spread across threads when there are enough of them.
+    class Evaluator {
+    public:
+        Evaluator(dcf::Section &root, const dcf::ParseOptions &options, const dcf::Value::allocator_type &allocator);
+        void evaluate();
+
+    private:
+        static constexpr size_t NONE = static_cast<size_t>(-1);
+        // Each thread gets at least this many calls of a level
+        static constexpr size_t PARALLEL_MIN_CALLS = 1024;
+
+        // A call, or a section or array with calls in it, which is done once they are
+        struct Node {
+            dcf::Value *slot;
+            // Null for sections and arrays
+            std::shared_ptr<FunctionCall> call;
+            // Null for @this
+            const dcf::Function *function;
+            std::vector<size_t> dependents;
+            // Dependencies that are not evaluated yet
+            size_t pending = 0;
+        };
+
+        dcf::Section &root;
+        const dcf::ParseOptions options;
+        const dcf::FunctionRegistry &functions;
+        const dcf::Value::allocator_type allocator;
+
+        // In document order
+        std::vector<Node> nodes;
+        std::unordered_map<const dcf::Value*, size_t> nodeAt;
+        // Arrays with calls in them, which may be packed once these are evaluated
+        std::vector<dcf::Value::Array*> arrays;
+
+        size_t collect(dcf::Value &value);
+        size_t addNode(dcf::Value &value, std::shared_ptr<FunctionCall> call);
+        void addDependency(size_t dependency, size_t node);
+        void linkReference(size_t node);
+        const dcf::Value& follow(const FunctionCall &call, dcf::Value &packedElement) const;
+        void evaluateLevel(const std::vector<size_t> &level);
+        void evaluateNode(Node &node);
+
+        static bool isCall(const dcf::Value &value);
+    };
+} // namespace dcf::internal
+
+
+
+inline dcf::FunctionRegistry::FunctionRegistry() {
+    add("concat", [](const std::pmr::vector<Value> &arguments) {
+        std::string text;
+        for(const Value &argument : arguments) {
+            switch(argument.getType()) {
+                case ValueType::STRING:
+                    text += argument.asString();
+                    break;
+                case ValueType::BOOLEAN:
+                    text += argument.asBool() ? "true" : "false";
+                    break;
+                case ValueType::INTEGER:
+                    internal::writeInteger(text, argument.asInt());
+                    break;
+                case ValueType::DOUBLE:
+                    internal::writeDouble(text, argument.asDouble());
+                    break;
+                default:
+                    throw std::runtime_error("Arrays and sections cannot be concatenated");
+            }
+        }
+        return Value(text);
+    });
+}
+
+
+inline void dcf::FunctionRegistry::add(std::string_view name, Function function) {
+    if(name == "this") {
+        throw std::invalid_argument("@this cannot be replaced");
+    }
+    functions[std::string(name)] = std::move(function);
+}
+
+
+inline const dcf::Function* dcf::FunctionRegistry::find(std::string_view name) const {
+    const auto found = functions.find(std::string(name));
+    return found == functions.end() ? nullptr : &found->second;
+}
+
+
+inline const dcf::FunctionRegistry& dcf::FunctionRegistry::builtins() {
+    static const FunctionRegistry registry;
+    return registry;
+}
+
+
+
+inline dcf::internal::FunctionCall::FunctionCall(std::string_view name, std::pmr::vector<dcf::Value> &&arguments,
+    size_t line, size_t column, const allocator_type &allocator)
+    : name(name, allocator), arguments(std::move(arguments), allocator), line(line), column(column) { }
+
+
+
+inline dcf::internal::Evaluator::Evaluator(dcf::Section &root, const dcf::ParseOptions &options, const dcf::Value::allocator_type &allocator)
+    : root(root), options(options),
+    functions(options.functions != nullptr ? *options.functions : dcf::FunctionRegistry::builtins()),
+    allocator(allocator) { }
+
+
+inline void dcf::internal::Evaluator::evaluate() {
+    for(dcf::Section::Entry &entry : root.write().entries) {
+        if(!entry.removed) {
+            collect(entry.value);
+        }
+    }
+    // References are linked once all nodes exist, they may point anywhere in the document
+    for(size_t i = 0; i < nodes.size(); i++) {
+        if(nodes[i].call != nullptr && nodes[i].function == nullptr) {
+            linkReference(i);
+        }
+    }
+
+    std::vector<size_t> level;
+    for(size_t i = 0; i < nodes.size(); i++) {
+        if(nodes[i].pending == 0) {
+            level.push_back(i);
+        }
+    }
+
+    size_t evaluated = 0;
+    std::vector<size_t> nextLevel;
+    while(!level.empty()) {
+        evaluateLevel(level);
+        evaluated += level.size();
+
+        nextLevel.clear();
+        for(size_t node : level) {
+            for(size_t dependent : nodes[node].dependents) {
+                if(--nodes[dependent].pending == 0) {
+                    nextLevel.push_back(dependent);
+                }
+            }
+        }
+        level.swap(nextLevel);
+    }
+
+    // Whatever is left waits on itself. Sections and arrays cannot do that on their own,
+    // so there is a call among them.
+    if(evaluated < nodes.size()) {
+        for(const Node &node : nodes) {
+            if(node.pending > 0 && node.call != nullptr) {
+                throw dcf::parse_error("Function call refers to itself in a cycle", node.call->line, node.call->column);
+            }
+        }
+    }
+
+    for(dcf::Value::Array *array : arrays) {
+        array->pack();
+    }
+}
+
+
+// Adds nodes for the calls in the value and for the value itself if it has any.
+// Returns the node of the value or NONE.
+inline size_t dcf::internal::Evaluator::collect(dcf::Value &value) {
+    if(auto call = std::get_if<std::shared_ptr<FunctionCall>>(&value.data)) {
+        const size_t node = addNode(value, *call);
+        for(dcf::Value &argument : (*call)->arguments) {
+            addDependency(collect(argument), node);
+        }
+        return node;
+    }
+
+    dcf::Value *contents = &value;
+    if(auto lazy = std::get_if<std::shared_ptr<const LazyValue>>(&value.data)) {
+        // Only sections and arrays with a call in their text have to be parsed now
+        const LazyValue &deferred = **lazy;
+        if(deferred.source->text.substr(deferred.begin, deferred.end - deferred.begin).find('@') == std::string_view::npos) {
+            return NONE;
+        }
+        resolve(deferred);
+        contents = &*deferred.value;
+    }
+
+    std::vector<size_t> children;
+    if(contents->type == dcf::ValueType::SECTION) {
+        for(dcf::Section::Entry &entry : std::get<std::shared_ptr<dcf::Section>>(contents->data)->write().entries) {
+            const size_t child = entry.removed ? NONE : collect(entry.value);
+            if(child != NONE) {
+                children.push_back(child);
+            }
+        }
+    } else if(contents->type == dcf::ValueType::ARRAY) {
+        // Arrays are shared by nothing else right after parsing. Packed ones have no calls.
+        dcf::Value::Array &array = *std::get<std::shared_ptr<dcf::Value::Array>>(contents->data);
+        for(dcf::Value &element : array.elements) {
+            const size_t child = collect(element);
+            if(child != NONE) {
+                children.push_back(child);
+            }
+        }
+        if(!children.empty()) {
+            arrays.push_back(&array);
+        }
+    }
+    if(children.empty()) {
+        return NONE;
+    }
+
+    const size_t node = addNode(value, nullptr);
+    for(size_t child : children) {
+        addDependency(child, node);
+    }
+    return node;
+}
+
+
+inline size_t dcf::internal::Evaluator::addNode(dcf::Value &value, std::shared_ptr<FunctionCall> call) {
+    const dcf::Function *function = nullptr;
+    if(call != nullptr && call->name != "this") {
+        function = functions.find(call->name);
+        if(function == nullptr) {
+            throw dcf::parse_error("Unknown function @" + std::string(call->name), call->line, call->column);
+        }
+    }
+
+    nodes.push_back({&value, std::move(call), function, {}, 0});
+    nodeAt.emplace(&value, nodes.size() - 1);
+    return nodes.size() - 1;
+}
+
+
+inline void dcf::internal::Evaluator::addDependency(size_t dependency, size_t node) {
+    if(dependency != NONE) {
+        nodes[dependency].dependents.push_back(node);
+        nodes[node].pending++;
+    }
+}
+
+
+// Makes the @this call depend on the value it refers to, or on the call in its way there
+inline void dcf::internal::Evaluator::linkReference(size_t node) {
+    const FunctionCall &call = *nodes[node].call;
+    if(call.arguments.size() != 1 || call.arguments[0].getType() != dcf::ValueType::STRING || isCall(call.arguments[0])) {
+        throw dcf::parse_error("@this takes the path of a value as a string", call.line, call.column);
+    }
+
+    // Packed elements are never calls, nothing depends on them
+    dcf::Value packedElement(false);
+    const auto found = nodeAt.find(&follow(call, packedElement));
+    if(found != nodeAt.end()) {
+        addDependency(found->second, node);
+    }
+}
+
+
+// The value at the path of the @this call. Stops early at a call in the way, which is only
+// there as long as the document is not evaluated. An element of a packed array is built
+// into the given value.
+inline const dcf::Value& dcf::internal::Evaluator::follow(const FunctionCall &call, dcf::Value &packedElement) const {
+    const std::string_view path = call.arguments[0].asString();
+    const dcf::Value *value = nullptr;
+    size_t start = 0;
+    while(true) {
+        const size_t dot = path.find('.', start);
+        const std::string_view part = path.substr(start, dot == std::string_view::npos ? dot : dot - start);
+
+        if(value == nullptr) {
+            value = root.find(part);
+        } else if(isCall(*value)) {
+            return *value;
+        } else if(value->type == dcf::ValueType::SECTION) {
+            value = value->asSection().find(part);
+        } else if(value->type == dcf::ValueType::ARRAY) {
+            const dcf::Value::Array &array = value->arrayContents();
+            size_t index = 0;
+            const std::from_chars_result result = std::from_chars(part.data(), part.data() + part.size(), index);
+            const bool valid = !part.empty() && result.ec == std::errc() && result.ptr == part.data() + part.size();
+            value = valid && index < array.size() ? &array.at(index, packedElement) : nullptr;
+        } else {
+            value = nullptr;
+        }
+
+        if(value == nullptr) {
+            throw dcf::parse_error("No value at path " + std::string(path), call.line, call.column);
+        }
+        if(dot == std::string_view::npos) {
+            return *value;
+        }
+        start = dot + 1;
+    }
+}
+
+
+inline void dcf::internal::Evaluator::evaluateLevel(const std::vector<size_t> &level) {
+    size_t threads = options.threads == 0 ? std::thread::hardware_concurrency() : options.threads;
+    threads = std::min(threads, level.size() / PARALLEL_MIN_CALLS);
+    if(threads < 2) {
+        for(size_t node : level) {
+            evaluateNode(nodes[node]);
+        }
+        return;
+    }
+
+    // The first error in document order is reported, the same one as on a single thread
+    std::vector<std::exception_ptr> errors(threads);
+    const auto evaluateRun = [&](size_t run) {
+        try {
+            for(size_t i = level.size() * run / threads; i < level.size() * (run + 1) / threads; i++) {
+                evaluateNode(nodes[level[i]]);
+            }
+        } catch(...) {
+            errors[run] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for(size_t run = 1; run < threads; run++) {
+        workers.emplace_back(evaluateRun, run);
+    }
+    evaluateRun(0);
+    for(std::thread &worker : workers) {
+        worker.join();
+    }
+
+    for(const std::exception_ptr &error : errors) {
+        if(error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+
+inline void dcf::internal::Evaluator::evaluateNode(Node &node) {
+    if(node.call == nullptr) {
+        return;
+    }
+
+    const FunctionCall &call = *node.call;
+    dcf::Value result(false);
+    if(node.function == nullptr) {
+        dcf::Value packedElement(false);
+        result = dcf::Value(follow(call, packedElement), allocator);
+    } else {
+        try {
+            result = (*node.function)(call.arguments);
+        } catch(const dcf::parse_error&) {
+            throw;
+        } catch(const std::exception &e) {
+            throw dcf::parse_error("@" + std::string(call.name) + " failed: " + e.what(), call.line, call.column);
+        }
+    }
+
+    // This releases the call, the slot holding the last reference to it other than the node
+    *node.slot = dcf::Value(std::move(result), allocator);
+    node.call = nullptr;
+}
+
+
+inline bool dcf::internal::Evaluator::isCall(const dcf::Value &value) {
+    return std::holds_alternative<std::shared_ptr<FunctionCall>>(value.data);
+}
+
+#endif // FUNCTION_HPP
@@ -0,0 +1,232 @@
+#ifndef HANDLER_HPP
+#define HANDLER_HPP
+
+#include "lexer.hpp"
+#include "options.hpp"
+#include "parser.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace dcf {
+
+    // Receives the parts of a document in order as it is parsed, without any sections or
+    // values being built. The root section comes as the outermost beginSection/endSection.
+    // Strings point into the parsed text and the lexer's comment and string rules apply,
+    // so keys, comments and strings are only valid as long as the text is.
+    class Handler {
+    public:
+        virtual ~Handler() = default;
+
+        virtual void beginSection() { }
+        virtual void endSection() { }
+        // Each comment of a pair's header, before the key of the pair
+        virtual void header(std::string_view /* comment */) { }
+        virtual void key(std::string_view /* key */) { }
+
+        virtual void stringValue(std::string_view /* value */) { }
+        virtual void boolValue(bool /* value */) { }
+        virtual void intValue(int64_t /* value */) { }
+        virtual void doubleValue(double /* value */) { }
+
+        virtual void beginArray() { }
+        virtual void endArray() { }
+        // The name comes without the leading '@'
+        virtual void beginFunction(std::string_view /* name */) { }
+        virtual void endFunction() { }
+    };
+} // namespace dcf
+
+
+namespace dcf::internal {
+
+    // Parses the same grammar as dcf::internal::Parser, but hands everything to a handler
+    // instead of building sections and values
+    class EventParser : private ParserBase {
+    public:
+        EventParser(Lexer &lexer, dcf::Handler &handler, const dcf::ParseOptions &options = {});
+        void parse();
+        // Parses just the value that comes next, for parsers that leave parts of their input
+        // to a handler
+        void parseNextValue();
+
+    private:
+        enum class Kind {
+            SECTION,
+            ARRAY,
+            FUNCTION
+        };
+
+        dcf::Handler &handler;
+        // Open sections, arrays and function calls
+        std::vector<Kind> stack;
+
+        void parseElements();
+        bool startElement(Kind kind);
+        bool parseValue();
+        bool takeComma();
+        void openFrame(Kind kind);
+        void closeFrame();
+    };
+} // namespace dcf::internal
+
+
+
+inline dcf::internal::EventParser::EventParser(Lexer &lexer, dcf::Handler &handler, const dcf::ParseOptions &options)
+    : ParserBase(lexer, options), handler(handler) { }
+
+
+inline void dcf::internal::EventParser::parse() {
+    matchNextNoComments(Token::Type::L_BRACE);
+    openFrame(Kind::SECTION);
+    handler.beginSection();
+    parseElements();
+    matchNextNoComments(Token::Type::END_OF_INPUT);
+}
+
+
+inline void dcf::internal::EventParser::parseNextValue() {
+    if(!parseValue()) {
+        parseElements();
+    }
+}
+
+
+// Parses the elements of all open frames up to the closing token of the outermost one
+inline void dcf::internal::EventParser::parseElements() {
+    // Set at the start of a frame and after a comma, when another element may follow
+    bool elementMayFollow = true;
+    while(!stack.empty()) {
+        if(elementMayFollow && startElement(stack.back())) {
+            // A nested frame starts out expecting its first element
+            elementMayFollow = !parseValue() || takeComma();
+            continue;
+        }
+        closeFrame();
+        elementMayFollow = !stack.empty() && takeComma();
+    }
+}
+
+
+// Takes what comes before the next element of the frame, which is the header, key and
+// colon of a pair. Returns false if the frame has no more elements.
+inline bool dcf::internal::EventParser::startElement(Kind kind) {
+    if(kind == Kind::SECTION) {
+        if(!nextWillMatchNoComments(Token::Type::KEY)) {
+            return false;
+        }
+        while(nextWillMatch(Token::Type::COMMENT)) {
+            handler.header(cleanCommentTokenValue(next()));
+        }
+        handler.key(matchNextNoComments(Token::Type::KEY).value);
+        matchNextNoComments(Token::Type::COLON);
+        return true;
+    }
+
+    switch(peekNextNoComments().type) {
+        case Token::Type::STRING:
+        case Token::Type::BOOLEAN:
+        case Token::Type::NUM_INT:
+        case Token::Type::NUM_DECIMAL:
+        case Token::Type::NUM_HEX:
+        case Token::Type::NUM_BINARY:
+        case Token::Type::L_BRACKET:
+        case Token::Type::L_BRACE:
+        case Token::Type::FUNCTION:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+// Parses the next value, unless it is a section, array or function call. Then only its
+// opening is taken, a frame is opened for it and false returned.
+inline bool dcf::internal::EventParser::parseValue() {
+    switch(peekNextNoComments().type) {
+        case Token::Type::STRING:
+            handler.stringValue(cleanStringTokenValue(nextNoComments()));
+            return true;
+
+        case Token::Type::BOOLEAN:
+            handler.boolValue(cleanBooleanTokenValue(nextNoComments()));
+            return true;
+
+        case Token::Type::NUM_INT:
+        case Token::Type::NUM_HEX:
+        case Token::Type::NUM_BINARY:
+            handler.intValue(cleanIntegerTokenValue(nextNoComments()));
+            return true;
+
+        case Token::Type::NUM_DECIMAL:
+            handler.doubleValue(cleanDoubleTokenValue(nextNoComments()));
+            return true;
+
+        case Token::Type::L_BRACKET:
+            matchNextNoComments(Token::Type::L_BRACKET);
+            openFrame(Kind::ARRAY);
+            handler.beginArray();
+            return false;
+
+        case Token::Type::L_BRACE:
+            matchNextNoComments(Token::Type::L_BRACE);
+            openFrame(Kind::SECTION);
+            handler.beginSection();
+            return false;
+
+        case Token::Type::FUNCTION: {
+            const std::string_view name = matchNextNoComments(Token::Type::FUNCTION).value.substr(1);
+            matchNextNoComments(Token::Type::L_PAREN);
+            openFrame(Kind::FUNCTION);
+            handler.beginFunction(name);
+            return false;
+        }
+
+        default:
+            nextNoComments();
+            error("value");
+    }
+}
+
+
+inline bool dcf::internal::EventParser::takeComma() {
+    if(!nextWillMatchNoComments(Token::Type::COMMA)) {
+        return false;
+    }
+    nextNoComments();
+    return true;
+}
+
+
+inline void dcf::internal::EventParser::openFrame(Kind kind) {
+    if(stack.size() >= options.maxDepth) {
+        throw dcf::parse_error("Nesting is deeper than " + std::to_string(options.maxDepth) + " levels", current.line, current.column);
+    }
+    stack.push_back(kind);
+}
+
+
+// Takes the closing token of the frame on top of the stack
+inline void dcf::internal::EventParser::closeFrame() {
+    switch(stack.back()) {
+        case Kind::SECTION:
+            matchNextNoComments(Token::Type::R_BRACE);
+            handler.endSection();
+            break;
+
+        case Kind::ARRAY:
+            matchNextNoComments(Token::Type::R_BRACKET);
+            handler.endArray();
+            break;
+
+        case Kind::FUNCTION:
+            matchNextNoComments(Token::Type::R_PAREN);
+            handler.endFunction();
+            break;
+    }
+    stack.pop_back();
+}
+
+#endif // HANDLER_HPP
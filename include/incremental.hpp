@@ -0,0 +1,285 @@
+#ifndef INCREMENTAL_HPP
+#define INCREMENTAL_HPP
+
+#include "diff.hpp"
+#include "function.hpp"
+#include "lexer.hpp"
+#include "options.hpp"
+#include "parser.hpp"
+#include "section.hpp"
+#include "simd.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace dcf {
+    // A document that is kept parsed as its text is edited. After an edit only the pairs
+    // of the root section that the edit touches are lexed and parsed again, all others keep
+    // their values. Documents with function calls, where an edit can change results
+    // anywhere, and documents whose root section has a key more than once are parsed again
+    // as a whole. They are always parsed right away and on one thread, the lazy and threads
+    // options don't apply.
+    class IncrementalDocument {
+    public:
+        IncrementalDocument(std::string text, const ParseOptions &options = {});
+
+        const Section& root() const;
+        std::string_view text() const;
+
+        // Each returns the paths of the values that were added, removed or changed by the
+        // edit and of the keys whose headers changed, those of the operations dcf::diff gives
+        // for it. An array whose length changed is reported as a whole. If the new text cannot
+        // be parsed the document is left as it was.
+        std::vector<std::string> update(std::string text);
+        // Replaces the given range of the text
+        std::vector<std::string> edit(size_t offset, size_t length, std::string_view replacement);
+
+    private:
+        using PairSpan = internal::Parser::PairSpan;
+
+        std::string documentText;
+        const ParseOptions options;
+        Section rootSection;
+        // Of the pairs of the root section, in the order of the text
+        std::vector<PairSpan> spans;
+        size_t openBrace = 0;
+        size_t closeBrace = 0;
+        // Any function calls or keys that are there more than once
+        bool parseWhole = false;
+
+        // Replaces [begin, end) of the text in place
+        std::vector<std::string> apply(size_t begin, size_t end, std::string_view replacement);
+        std::vector<std::string> reparseWhole(std::string &&text);
+        void parse(std::string_view text, Section &root, std::vector<PairSpan> &spans,
+            size_t &openBrace, size_t &closeBrace, bool &parseWhole) const;
+        static std::vector<std::string> changes(const Section &before, const Section &after);
+    };
+} // namespace dcf
+
+
+
+inline dcf::IncrementalDocument::IncrementalDocument(std::string text, const ParseOptions &options)
+    : documentText(std::move(text)), options(options) {
+    parse(documentText, rootSection, spans, openBrace, closeBrace, parseWhole);
+}
+
+
+inline const dcf::Section& dcf::IncrementalDocument::root() const {
+    return rootSection;
+}
+
+
+inline std::string_view dcf::IncrementalDocument::text() const {
+    return documentText;
+}
+
+
+inline std::vector<std::string> dcf::IncrementalDocument::update(std::string text) {
+    // The edit is whatever lies between the longest common prefix and suffix
+    const size_t shorter = std::min(text.size(), documentText.size());
+    size_t prefix = 0;
+    while(prefix < shorter && text[prefix] == documentText[prefix]) {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while(suffix < shorter - prefix && text[text.size() - 1 - suffix] == documentText[documentText.size() - 1 - suffix]) {
+        suffix++;
+    }
+    return apply(prefix, documentText.size() - suffix, std::string_view(text).substr(prefix, text.size() - suffix - prefix));
+}
+
+
+inline std::vector<std::string> dcf::IncrementalDocument::edit(size_t offset, size_t length, std::string_view replacement) {
+    if(offset > documentText.size()) {
+        throw std::out_of_range("Edit starts after the end of the text");
+    }
+    length = std::min(length, documentText.size() - offset);
+    return apply(offset, offset + length, replacement);
+}
+
+
+// Only the edited pairs are looked at, the text is changed in place and only copied as a
+// whole when it has to be parsed as a whole
+inline std::vector<std::string> dcf::IncrementalDocument::apply(size_t begin, size_t end, std::string_view replacement) {
+    // Documents with calls are parsed as a whole, so only the replacement can bring one in
+    if(parseWhole || begin <= openBrace || end > closeBrace || replacement.find('@') != std::string_view::npos) {
+        std::string text = documentText;
+        text.replace(begin, end - begin, replacement);
+        return reparseWhole(std::move(text));
+    }
+
+    // The pairs to parse again go from the first one that the edit reaches, counting its
+    // comma, to the last one that starts no later than the edit ends. A last pair without
+    // a comma is always taken along, text added after it has to be separated from it.
+    // The spans are in the order of the text, so the pairs before the edit are a prefix
+    size_t first = static_cast<size_t>(std::partition_point(spans.begin(), spans.end(),
+        [begin](const PairSpan &span) { return span.end < begin && span.after <= begin; }) - spans.begin());
+    if(first == spans.size() && first > 0 && spans[first - 1].after == spans[first - 1].end) {
+        first--;
+    }
+    size_t last = first;
+    while(last < spans.size() && spans[last].begin <= end) {
+        last++;
+    }
+
+    // [regionBegin, regionEnd) of the old text holds the pairs first up to before last,
+    // along with everything around them up to the next pair or the closing brace
+    const size_t regionBegin = first == 0 ? openBrace + 1 : spans[first - 1].after;
+    const size_t regionEnd = last < spans.size() ? spans[last].begin : closeBrace;
+    const size_t newRegionEnd = regionEnd + replacement.size() - (end - begin);
+
+    // Until the edit is taken, the replaced text is kept to put back. Whatever goes wrong
+    // from here is left to a parse of the whole text, which leaves the document as it was
+    // if that fails too.
+    const std::string replaced = documentText.substr(begin, end - begin);
+    documentText.replace(begin, end - begin, replacement);
+    const auto fallBack = [this, begin, &replacement, &replaced]() {
+        std::string text = documentText;
+        documentText.replace(begin, replacement.size(), replaced);
+        return reparseWhole(std::move(text));
+    };
+
+    // The region may not parse on its own where the whole text does, like when a comment or
+    // string opened in it is closed further on, so errors are left to a parse of the whole.
+    // That is also why the region is lexed without counting the lines before it, positions
+    // would only show up in those errors. A region of nothing but whitespace has nothing to
+    // parse, the lexer rejects it.
+    const std::string_view regionText = std::string_view(documentText).substr(0, newRegionEnd);
+    std::vector<PairSpan> regionSpans;
+    Section region;
+    if(internal::simd::findNonWhitespace(regionText, regionBegin) < newRegionEnd) {
+        try {
+            internal::Lexer lexer(regionText, regionBegin);
+            region = internal::Parser(lexer, options).parsePairs(regionSpans);
+        } catch(const dcf::parse_error&) {
+            return fallBack();
+        }
+    }
+    // Only whitespace may follow the last pair of the region. Comments there would belong to
+    // the header of the pair after it, or hide the closing brace. A pair that follows also
+    // has to be separated from the region by a comma.
+    const size_t tail = regionSpans.empty() ? regionBegin : regionSpans.back().after;
+    const bool missingComma = !regionSpans.empty() && last < spans.size() && regionSpans.back().after == regionSpans.back().end;
+    if(missingComma || internal::simd::findNonWhitespace(regionText, tail) < newRegionEnd) {
+        return fallBack();
+    }
+
+    // Keys that are now there more than once need the whole document parsed again
+    if(region.read().entries.size() != regionSpans.size()) {
+        return fallBack();
+    }
+    for(const Section::Entry &entry : region.read().entries) {
+        const size_t position = rootSection.locate(entry.key);
+        if(position != Section::NOT_FOUND && (position < first || position >= last)) {
+            return fallBack();
+        }
+    }
+
+    // Nothing can fail from here on
+    Section before;
+    Section::Contents &current = rootSection.write();
+    for(size_t i = first; i < last; i++) {
+        Section::Entry &entry = current.entries[i];
+        before.set(entry.key, std::move(entry.value));
+        before.setHeader(entry.key, entry.header);
+    }
+    std::vector<std::string> changed = changes(before, region);
+
+    // Most edits keep the keys where they are, then the index stays as it is
+    auto &entries = rootSection.write().entries;
+    auto &replacements = region.write().entries;
+    bool sameKeys = replacements.size() == last - first;
+    for(size_t i = 0; sameKeys && i < replacements.size(); i++) {
+        sameKeys = replacements[i].key == entries[first + i].key;
+    }
+    if(sameKeys) {
+        std::move(replacements.begin(), replacements.end(), entries.begin() + static_cast<std::ptrdiff_t>(first));
+    } else {
+        entries.erase(entries.begin() + static_cast<std::ptrdiff_t>(first), entries.begin() + static_cast<std::ptrdiff_t>(last));
+        entries.insert(entries.begin() + static_cast<std::ptrdiff_t>(first),
+            std::make_move_iterator(replacements.begin()), std::make_move_iterator(replacements.end()));
+        rootSection.rebuildIndex();
+    }
+
+    // Spans after the region only move if the length of the text changed
+    const size_t shift = replacement.size() - (end - begin);
+    if(shift != 0) {
+        for(size_t i = last; i < spans.size(); i++) {
+            spans[i].begin += shift;
+            spans[i].end += shift;
+            spans[i].after += shift;
+        }
+        closeBrace += shift;
+    }
+    if(regionSpans.size() == last - first) {
+        std::copy(regionSpans.begin(), regionSpans.end(), spans.begin() + static_cast<std::ptrdiff_t>(first));
+    } else {
+        spans.erase(spans.begin() + static_cast<std::ptrdiff_t>(first), spans.begin() + static_cast<std::ptrdiff_t>(last));
+        spans.insert(spans.begin() + static_cast<std::ptrdiff_t>(first), regionSpans.begin(), regionSpans.end());
+    }
+    return changed;
+}
+
+
+inline std::vector<std::string> dcf::IncrementalDocument::reparseWhole(std::string &&text) {
+    Section root;
+    std::vector<PairSpan> newSpans;
+    size_t newOpenBrace = 0;
+    size_t newCloseBrace = 0;
+    bool newParseWhole = false;
+    parse(text, root, newSpans, newOpenBrace, newCloseBrace, newParseWhole);
+
+    std::vector<std::string> changed = changes(rootSection, root);
+
+    rootSection = std::move(root);
+    spans = std::move(newSpans);
+    openBrace = newOpenBrace;
+    closeBrace = newCloseBrace;
+    parseWhole = newParseWhole;
+    documentText = std::move(text);
+    return changed;
+}
+
+
+inline void dcf::IncrementalDocument::parse(std::string_view text, Section &root, std::vector<PairSpan> &spans,
+    size_t &openBrace, size_t &closeBrace, bool &parseWhole) const {
+    internal::Lexer lexer(text);
+    root = internal::Parser(lexer, options).parse(spans);
+
+    // The text parsed, so the braces are the first tokens other than comments at either end
+    const auto nextToken = [text](size_t from) {
+        internal::Lexer braceLexer(text, from);
+        internal::Token token = braceLexer.next();
+        while(token.type == internal::Token::Type::COMMENT) {
+            token = braceLexer.next();
+        }
+        return braceLexer.position(token);
+    };
+    openBrace = nextToken(0);
+    closeBrace = nextToken(spans.empty() ? openBrace + 1 : spans.back().after);
+
+    // Without an '@' anywhere there are no function calls to evaluate
+    const bool hasFunctions = text.find('@') != std::string_view::npos;
+    if(hasFunctions) {
+        internal::Evaluator(root, options, {}).evaluate();
+    }
+    parseWhole = hasFunctions || root.read().entries.size() != spans.size();
+}
+
+
+
+// The values in the patch share their contents with the ones of the tree after the edit,
+// both are in the default memory resource, so making it copies nothing
+inline std::vector<std::string> dcf::IncrementalDocument::changes(const Section &before, const Section &after) {
+    std::vector<std::string> paths;
+    for(PatchOperation &operation : dcf::diff(before, after)) {
+        paths.push_back(std::move(operation.path));
+    }
+    return paths;
+}
+
+#endif // INCREMENTAL_HPP
@@ -0,0 +1,71 @@
+#ifndef KEY_HPP
+#define KEY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+
+namespace dcf {
+    class Section;
+
+    namespace internal {
+        inline size_t hashKey(std::string_view key) {
+            return std::hash<std::string_view>{}(key);
+        }
+
+        // Spreads the bits of a hash over all of its bits, the finalizer of splitmix64
+        inline uint64_t mixHash(uint64_t hash) {
+            hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+            return hash ^ (hash >> 31);
+        }
+    } // namespace internal
+
+    // A key for repeated lookups. Its hash is computed once, and it remembers where it was
+    // found last, so looking it up again in the same, unchanged section is a single compare.
+    // The remembered position is only a hint that is verified on use, so a key can be
+    // shared between threads and used with any number of sections.
+    class Key {
+    public:
+        explicit Key(std::string_view name);
+        Key(const Key& other);
+        Key& operator=(const Key& other);
+
+        std::string_view name() const;
+
+    private:
+        friend class Section;
+
+        std::string keyName;
+        size_t hash;
+        mutable std::atomic<uint32_t> positionHint{0};
+    };
+} // namespace dcf
+
+
+
+inline dcf::Key::Key(std::string_view name)
+    : keyName(name), hash(internal::hashKey(name)) { }
+
+inline dcf::Key::Key(const Key& other)
+    : keyName(other.keyName), hash(other.hash), positionHint(other.positionHint.load(std::memory_order_relaxed)) { }
+
+
+inline dcf::Key& dcf::Key::operator=(const Key& other) {
+    if(this != &other) {
+        keyName = other.keyName;
+        hash = other.hash;
+        positionHint.store(other.positionHint.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+
+inline std::string_view dcf::Key::name() const {
+    return keyName;
+}
+
+#endif // KEY_HPP
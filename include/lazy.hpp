@@ -0,0 +1,197 @@
+#ifndef LAZY_HPP
+#define LAZY_HPP
+
+#include "lexer.hpp"
+#include "options.hpp"
+#include "simd.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+
+namespace dcf::internal {
+
+    // Positions of all braces, brackets, parentheses and commas outside of strings and
+    // comments, with every bracket linked to its partner and every comma to the bracket
+    // enclosing it. Built in one pass over the text before parsing, so the parser can jump
+    // over whole sections and arrays without lexing them.
+    class StructuralIndex {
+    public:
+        static constexpr uint32_t NONE = UINT32_MAX;
+
+        // Returns false if the text is too large or its brackets don't match up,
+        // the parser then has to go through it token by token to report the error
+        bool build(std::string_view text);
+
+        // Position of the bracket closing the one at the given position, or npos if there
+        // is no bracket at that position
+        size_t closing(size_t opening) const;
+        // Positions of the commas directly within the bracket at the given position
+        std::vector<size_t> commas(size_t opening) const;
+
+    private:
+        struct Structural {
+            uint32_t position;
+            uint32_t partner;
+        };
+
+        std::vector<Structural> structurals;
+
+        size_t find(size_t position) const;
+    };
+
+
+    // The text of a lazily parsed document together with its structural index.
+    // Shared by all values that are yet to be parsed and keeps the text alive for them.
+    struct LazySource {
+        std::shared_ptr<const void> owner;
+        std::string_view text;
+        StructuralIndex index;
+        // The options the document is parsed with, the values are parsed with them too.
+        // Without the function registry, which only has to outlive the first parse.
+        dcf::ParseOptions options;
+        // The values of a document may share a memory resource that is not thread safe,
+        // like the arena of a dcf::Document, so they are parsed one at a time
+        mutable std::mutex parsing;
+
+        // Returns nullptr if the text cannot be indexed
+        static std::shared_ptr<const LazySource> create(std::shared_ptr<const void> owner, std::string_view text,
+            const dcf::ParseOptions &options);
+    };
+
+
+    // A section or array that has not been parsed yet. It is parsed the first time it is
+    // accessed, from any thread, and the result is kept.
+    struct LazyValue {
+        using allocator_type = dcf::Value::allocator_type;
+
+        std::shared_ptr<const LazySource> source;
+        // Positions of the opening and closing bracket
+        size_t begin;
+        size_t end;
+        size_t line;
+        size_t column;
+        // Nesting depth of the section or array itself
+        size_t depth;
+        allocator_type allocator;
+
+        mutable std::once_flag parsed;
+        mutable std::optional<dcf::Value> value;
+
+        LazyValue(std::shared_ptr<const LazySource> source, size_t begin, size_t end,
+            size_t line, size_t column, size_t depth, const allocator_type &allocator);
+    };
+} // namespace dcf::internal
+
+
+
+inline bool dcf::internal::StructuralIndex::build(std::string_view text) {
+    structurals.clear();
+    if(text.size() >= NONE) {
+        return false;
+    }
+
+    std::vector<uint32_t> open;
+    size_t pos = 0;
+    while((pos = simd::findAny<'{', '}', '[', ']', '(', ')', ',', '"', '\'', '/'>(text, pos)) != std::string_view::npos) {
+        const char c = text[pos];
+
+        // Strings and comments are skipped with the lexer's own rules
+        if(c == '"' || c == '\'' || c == '/') {
+            const size_t length = c == '/' ? scanComment(text, pos) : scanString(text, pos);
+            if(length == 0) {
+                return false;
+            }
+            pos += length;
+            continue;
+        }
+
+        const uint32_t current = static_cast<uint32_t>(structurals.size());
+        if(c == '{' || c == '[' || c == '(') {
+            structurals.push_back({static_cast<uint32_t>(pos), NONE});
+            open.push_back(current);
+        } else if(c == ',') {
+            structurals.push_back({static_cast<uint32_t>(pos), open.empty() ? NONE : open.back()});
+        } else {
+            const char expected = c == '}' ? '{' : (c == ']' ? '[' : '(');
+            if(open.empty() || text[structurals[open.back()].position] != expected) {
+                return false;
+            }
+            structurals[open.back()].partner = current;
+            structurals.push_back({static_cast<uint32_t>(pos), open.back()});
+            open.pop_back();
+        }
+        pos++;
+    }
+
+    return open.empty();
+}
+
+
+inline size_t dcf::internal::StructuralIndex::closing(size_t opening) const {
+    const size_t found = find(opening);
+    if(found == NONE) {
+        return std::string_view::npos;
+    }
+    return structurals[structurals[found].partner].position;
+}
+
+
+inline std::vector<size_t> dcf::internal::StructuralIndex::commas(size_t opening) const {
+    std::vector<size_t> positions;
+    const size_t found = find(opening);
+    if(found == NONE) {
+        return positions;
+    }
+    for(size_t i = found + 1; i < structurals[found].partner; i++) {
+        if(structurals[i].partner == found) {
+            positions.push_back(structurals[i].position);
+        } else if(structurals[i].partner > i) {
+            // Nested bracket, continue after its partner
+            i = structurals[i].partner;
+        }
+    }
+    return positions;
+}
+
+
+// Index of the structural at the given position, or NONE
+inline size_t dcf::internal::StructuralIndex::find(size_t position) const {
+    const auto found = std::lower_bound(structurals.begin(), structurals.end(), position,
+        [](const Structural &structural, size_t position) { return structural.position < position; });
+    if(found == structurals.end() || found->position != position) {
+        return NONE;
+    }
+    return static_cast<size_t>(found - structurals.begin());
+}
+
+
+inline std::shared_ptr<const dcf::internal::LazySource> dcf::internal::LazySource::create(
+    std::shared_ptr<const void> owner, std::string_view text, const dcf::ParseOptions &options) {
+    auto source = std::make_shared<LazySource>();
+    if(!source->index.build(text)) {
+        return nullptr;
+    }
+    source->owner = std::move(owner);
+    source->text = text;
+    source->options = options;
+    source->options.functions = nullptr;
+    return source;
+}
+
+
+inline dcf::internal::LazyValue::LazyValue(std::shared_ptr<const LazySource> source, size_t begin, size_t end,
+    size_t line, size_t column, size_t depth, const allocator_type &allocator)
+    : source(std::move(source)), begin(begin), end(end), line(line), column(column), depth(depth), allocator(allocator) { }
+
+
+inline std::pmr::memory_resource* dcf::internal::resourceOf(const LazyValue &lazy) {
+    return lazy.allocator.resource();
+}
+
+#endif // LAZY_HPP
@@ -2,7 +2,10 @@
 #define LEXER_HPP
 
 #include "dcf.hpp"
-#include <regex>
+#include "simd.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
 
 
 namespace dcf {
@@ -49,7 +52,7 @@ namespace dcf::internal {
 
     class Token {
     public:
-        const enum class Type {
+        enum class Type {
             WHITESPACE,
             COMMENT,
             STRING,
@@ -69,12 +72,14 @@ namespace dcf::internal {
             COLON,
             COMMA,
             END_OF_INPUT
-        } type;
-        const std::string value;
-        const size_t line;
-        const size_t column;
+        };
 
-        Token(Type type, const std::string &value, size_t line, size_t column)
+        Type type;
+        std::string_view value;
+        size_t line;
+        size_t column;
+
+        Token(Type type, std::string_view value, size_t line, size_t column)
             : type(type), value(value), line(line), column(column) {}
     };
 
@@ -104,83 +109,340 @@ namespace dcf::internal {
     }
 
 
-    class TokenDefinition {
-    public:
-        TokenDefinition(const std::string &pattern, Token::Type type)
-            : regex("^(?:" + pattern + ")"), type(type) {}
+    inline bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
 
-        const std::regex regex;
-        const Token::Type type;
-    };
+    inline bool isHexDigit(char c) {
+        return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    }
+
+    inline bool isLetter(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
 
+    inline bool isAlphanumeric(char c) {
+        return isLetter(c) || isDigit(c);
+    }
 
-    const TokenDefinition TOKEN_DEFINITIONS[] = {
-        {R"(\s+)",                                                      Token::Type::WHITESPACE},
-        {R"(//[^\n]*|/\*(?:.|\n)*?\*/)",                                Token::Type::COMMENT},
-        {R"("[^"\n]*"|'[^'\n]*')",                                      Token::Type::STRING},
-        {R"(true|false)",                                               Token::Type::BOOLEAN},
-        {R"(-?(?:\d+\.\d*|\.\d+)(?:[eE][+-]?\d+)?|-?\d+[eE][+-]?\d+)",  Token::Type::NUM_DECIMAL},
-        {R"(-?0x[\da-fA-F]+)",                                          Token::Type::NUM_HEX},
-        {R"(-?0b[01]+)",                                                Token::Type::NUM_BINARY},
-        {R"(-?\d+)",                                                    Token::Type::NUM_INT},
-        {R"([a-zA-Z](?:[\w-]*[a-zA-Z0-9])?)",                           Token::Type::KEY},
-        {R"(@[a-zA-Z]+)",                                               Token::Type::FUNCTION},
-        {R"(\()",                                                       Token::Type::L_PAREN},
-        {R"(\))",                                                       Token::Type::R_PAREN},
-        {R"(\{)",                                                       Token::Type::L_BRACE},
-        {R"(})",                                                        Token::Type::R_BRACE},
-        {R"(\[)",                                                       Token::Type::L_BRACKET},
-        {R"(])",                                                        Token::Type::R_BRACKET},
-        {R"(:)",                                                        Token::Type::COLON},
-        {R"(,)",                                                        Token::Type::COMMA}
-    };
 
+    // Every scan function below gets the position of a token candidate and returns the
+    // length of the matched token, or zero if the input at that position is not such a token.
+
+    inline size_t countDigits(std::string_view input, size_t pos) {
+        size_t end = pos;
+        while(end < input.size() && isDigit(input[end])) {
+            end++;
+        }
+        return end - pos;
+    }
 
-    void tokenize(const std::string &text, std::vector<Token> &tokens) {
-        std::size_t line = 1, column = 1, pos = 0;
-        std::string_view input = text;
-
-        while(pos < input.size()) {
-            bool matched = false;
-            std::string_view current = input.substr(pos);
-
-            for(const TokenDefinition &def : TOKEN_DEFINITIONS) {
-                std::cmatch match;
-                if(std::regex_search(current.begin(), current.end(), match, def.regex)) {
-                    matched = true;
-                    const std::string matchStr = match.str(0);
-                    const Token::Type type = def.type;
-
-                    if(type != Token::Type::WHITESPACE) {
-                        tokens.emplace_back(type, matchStr, line, column);
-                    }
-
-                    // Whitespace or comment might span multiple lines
-                    if(type == Token::Type::WHITESPACE || type == Token::Type::COMMENT) {
-                        for(char c : matchStr) {
-                            if(c == '\n') {
-                                line++;
-                                column = 1;
-                            } else {
-                                column++;
-                            }
-                        }
-
-                    // the rest doesn't
-                    } else {
-                        column += match.length();
-                    }
-
-                    pos += match.length();
-                    break;
+    inline size_t scanWhitespace(std::string_view input, size_t pos) {
+        return simd::findNonWhitespace(input, pos) - pos;
+    }
+
+    inline size_t scanComment(std::string_view input, size_t pos) {
+        if(pos + 1 >= input.size()) {
+            return 0;
+        }
+
+        if(input[pos + 1] == '/') {
+            size_t end = input.find('\n', pos + 2);
+            return (end == std::string_view::npos ? input.size() : end) - pos;
+        }
+
+        if(input[pos + 1] == '*') {
+            // Block comments may not contain a carriage return, same as with the former regex '.'
+            size_t end = pos + 2;
+            while((end = simd::findEither(input, end, '*', '\r')) != std::string_view::npos) {
+                if(input[end] == '\r') {
+                    return 0;
                 }
+                if(end + 1 < input.size() && input[end + 1] == '/') {
+                    return end + 2 - pos;
+                }
+                end++;
             }
+        }
 
-            if(!matched) {
-                throw dcf::parse_error("Unknown token", line, column);
+        return 0;
+    }
+
+    inline size_t scanString(std::string_view input, size_t pos) {
+        const size_t end = simd::findEither(input, pos + 1, input[pos], '\n');
+        if(end == std::string_view::npos || input[end] == '\n') {
+            return 0;
+        }
+        return end + 1 - pos;
+    }
+
+    inline size_t scanExponent(std::string_view input, size_t pos) {
+        if(pos >= input.size() || (input[pos] != 'e' && input[pos] != 'E')) {
+            return 0;
+        }
+        size_t end = pos + 1;
+        if(end < input.size() && (input[end] == '+' || input[end] == '-')) {
+            end++;
+        }
+        size_t digits = countDigits(input, end);
+        return digits == 0 ? 0 : end + digits - pos;
+    }
+
+    inline size_t scanDecimal(std::string_view input, size_t pos) {
+        size_t start = input[pos] == '-' ? pos + 1 : pos;
+        size_t integerDigits = countDigits(input, start);
+        size_t end = start + integerDigits;
+
+        // digits '.' digits? or '.' digits, both with an optional exponent
+        if(end < input.size() && input[end] == '.') {
+            size_t fractionDigits = countDigits(input, end + 1);
+            if(integerDigits > 0 || fractionDigits > 0) {
+                end += 1 + fractionDigits;
+                return end + scanExponent(input, end) - pos;
+            }
+            return 0;
+        }
+
+        // digits with a mandatory exponent
+        if(integerDigits > 0) {
+            size_t exponent = scanExponent(input, end);
+            return exponent == 0 ? 0 : end + exponent - pos;
+        }
+        return 0;
+    }
+
+    inline size_t scanPrefixedInteger(std::string_view input, size_t pos, char prefix, bool (*isValidDigit)(char)) {
+        size_t start = input[pos] == '-' ? pos + 1 : pos;
+        if(start + 2 >= input.size() || input[start] != '0' || input[start + 1] != prefix) {
+            return 0;
+        }
+        size_t end = start + 2;
+        while(end < input.size() && isValidDigit(input[end])) {
+            end++;
+        }
+        return end == start + 2 ? 0 : end - pos;
+    }
+
+    inline size_t scanInteger(std::string_view input, size_t pos) {
+        size_t start = input[pos] == '-' ? pos + 1 : pos;
+        size_t digits = countDigits(input, start);
+        return digits == 0 ? 0 : start + digits - pos;
+    }
+
+    inline size_t scanKeyword(std::string_view input, size_t pos, std::string_view keyword) {
+        return input.compare(pos, keyword.size(), keyword) == 0 ? keyword.size() : 0;
+    }
+
+    inline size_t scanKey(std::string_view input, size_t pos) {
+        // A key has to end with a letter or digit, so '_' and '-' at the end are not part of it
+        size_t length = 1;
+        for(size_t end = pos + 1; end < input.size(); end++) {
+            const char c = input[end];
+            if(isAlphanumeric(c)) {
+                length = end + 1 - pos;
+            } else if(c != '_' && c != '-') {
+                break;
             }
         }
+        return length;
     }
+
+    inline size_t scanFunction(std::string_view input, size_t pos) {
+        size_t end = pos + 1;
+        while(end < input.size() && isLetter(input[end])) {
+            end++;
+        }
+        return end == pos + 1 ? 0 : end - pos;
+    }
+
+
+    // Recognizes the token at the position by looking at its first character. Where token types
+    // share a first character, they are tried in the same order the grammar gives them precedence.
+    inline size_t scanToken(std::string_view input, size_t pos, Token::Type &type) {
+        const char c = input[pos];
+        size_t length;
+
+        switch(c) {
+            case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+                type = Token::Type::WHITESPACE;
+                return scanWhitespace(input, pos);
+
+            case '/':
+                type = Token::Type::COMMENT;
+                return scanComment(input, pos);
+
+            case '"': case '\'':
+                type = Token::Type::STRING;
+                return scanString(input, pos);
+
+            case '(': type = Token::Type::L_PAREN;   return 1;
+            case ')': type = Token::Type::R_PAREN;   return 1;
+            case '{': type = Token::Type::L_BRACE;   return 1;
+            case '}': type = Token::Type::R_BRACE;   return 1;
+            case '[': type = Token::Type::L_BRACKET; return 1;
+            case ']': type = Token::Type::R_BRACKET; return 1;
+            case ':': type = Token::Type::COLON;     return 1;
+            case ',': type = Token::Type::COMMA;     return 1;
+
+            case '@':
+                type = Token::Type::FUNCTION;
+                return scanFunction(input, pos);
+
+            case 't':
+            case 'f':
+                length = scanKeyword(input, pos, c == 't' ? "true" : "false");
+                if(length > 0) {
+                    type = Token::Type::BOOLEAN;
+                    return length;
+                }
+                type = Token::Type::KEY;
+                return scanKey(input, pos);
+
+            default:
+                break;
+        }
+
+        if(isLetter(c)) {
+            type = Token::Type::KEY;
+            return scanKey(input, pos);
+        }
+
+        if(isDigit(c) || c == '-' || c == '.') {
+            if((length = scanDecimal(input, pos)) > 0) {
+                type = Token::Type::NUM_DECIMAL;
+            } else if((length = scanPrefixedInteger(input, pos, 'x', isHexDigit)) > 0) {
+                type = Token::Type::NUM_HEX;
+            } else if((length = scanPrefixedInteger(input, pos, 'b', [](char d) { return d == '0' || d == '1'; })) > 0) {
+                type = Token::Type::NUM_BINARY;
+            } else {
+                type = Token::Type::NUM_INT;
+                length = scanInteger(input, pos);
+            }
+            return length;
+        }
+
+        return 0;
+    }
+
+
+    // Pulls tokens out of the input one at a time, skipping whitespace. Tokens that were
+    // peeked at are buffered until they are taken, so the lookahead never holds more than
+    // the next non-comment token and the comments in front of it.
+    // The tokens only reference slices of the input, so it has to outlive them.
+    class Lexer {
+    public:
+        // Lexing may start further into the input, at the given line and column
+        Lexer(std::string_view input, size_t start = 0, size_t line = 1, size_t column = 1);
+
+        Token next();
+        // The reference is only valid until the next call on the lexer, peeking further
+        // ahead can move the buffered tokens
+        const Token& peek(size_t offset = 0);
+
+        // Offset of the token in the input
+        size_t position(const Token &token) const;
+        // Continues lexing at the given offset without looking at anything before it
+        void skipTo(size_t offset);
+
+    private:
+        const std::string_view input;
+        size_t pos;
+        size_t line;
+        size_t column;
+
+        bool hadToken = false;
+        size_t endLine;
+        size_t endColumn;
+
+        // Peeked tokens from lookaheadStart on. Taken ones stay until all are taken, then the
+        // buffer is cleared and keeps its capacity for the next ones.
+        std::vector<Token> lookahead;
+        size_t lookaheadStart = 0;
+
+        Token scan();
+    };
 } // namespace dcf::internal
 
+
+inline dcf::internal::Lexer::Lexer(std::string_view input, size_t start, size_t line, size_t column)
+    : input(input), pos(start), line(line), column(column), endLine(line), endColumn(column) { }
+
+inline dcf::internal::Token dcf::internal::Lexer::next() {
+    if(lookaheadStart == lookahead.size()) {
+        return scan();
+    }
+    Token token = lookahead[lookaheadStart++];
+    if(lookaheadStart == lookahead.size()) {
+        lookahead.clear();
+        lookaheadStart = 0;
+    }
+    return token;
+}
+
+inline const dcf::internal::Token& dcf::internal::Lexer::peek(size_t offset) {
+    while(lookahead.size() - lookaheadStart <= offset) {
+        lookahead.push_back(scan());
+    }
+    return lookahead[lookaheadStart + offset];
+}
+
+inline size_t dcf::internal::Lexer::position(const Token &token) const {
+    return static_cast<size_t>(token.value.data() - input.data());
+}
+
+inline void dcf::internal::Lexer::skipTo(size_t offset) {
+    lookahead.clear();
+    lookaheadStart = 0;
+
+    const simd::NewlineCount newlines = simd::countNewlines(input, pos, offset);
+    if(newlines.count > 0) {
+        line += newlines.count;
+        column = offset - newlines.last;
+    } else {
+        column += offset - pos;
+    }
+    pos = offset;
+}
+
+inline dcf::internal::Token dcf::internal::Lexer::scan() {
+    while(pos < input.size()) {
+        Token::Type type;
+        const size_t length = scanToken(input, pos, type);
+        if(length == 0) {
+            throw dcf::parse_error("Unknown token", line, column);
+        }
+
+        const Token token(type, input.substr(pos, length), line, column);
+
+        // Whitespace or comment might span multiple lines
+        if(type == Token::Type::WHITESPACE || type == Token::Type::COMMENT) {
+            const simd::NewlineCount newlines = simd::countNewlines(input, pos, pos + length);
+            if(newlines.count > 0) {
+                line += newlines.count;
+                column = pos + length - newlines.last;
+            } else {
+                column += length;
+            }
+
+        // the rest doesn't
+        } else {
+            column += length;
+        }
+
+        pos += length;
+
+        if(type != Token::Type::WHITESPACE) {
+            hadToken = true;
+            endLine = token.line;
+            endColumn = token.column + length;
+            return token;
+        }
+    }
+
+    if(!hadToken) {
+        throw parse_error("Expected content in input but got nothing");
+    }
+    return Token(Token::Type::END_OF_INPUT, "", endLine, endColumn);
+}
+
 #endif // LEXER_HPP
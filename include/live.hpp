@@ -0,0 +1,280 @@
+#ifndef LIVE_HPP
+#define LIVE_HPP
+
+#include "options.hpp"
+#include "parser.hpp"
+#include "section.hpp"
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+    #include <cerrno>
+    #include <cstring>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+    #define DCF_INOTIFY
+#endif
+
+
+namespace dcf {
+    // The section parsed from a file, kept up to date as the file changes. Each parse
+    // publishes a new immutable snapshot, readers keep whichever snapshot they hold until
+    // they ask again. A file that fails to parse leaves the current snapshot in place.
+    // On Linux the file is watched and parsed again on a thread of its own whenever it is
+    // written or replaced, elsewhere, or if it cannot be watched, reload has to be called.
+    class LiveConfig {
+    public:
+        // Parses the file right away and throws if that fails
+        LiveConfig(const std::string &path, const ParseOptions &options = {});
+        ~LiveConfig();
+
+        LiveConfig(const LiveConfig&) = delete;
+        LiveConfig& operator=(const LiveConfig&) = delete;
+
+        // The current snapshot, which stays valid for as long as it is held
+        std::shared_ptr<const Section> snapshot() const;
+        // Number of snapshots published so far, starting at one for the initial parse
+        uint64_t version() const;
+
+        // Parses the file again. Returns false and keeps the current snapshot if that fails.
+        bool reload();
+        // Why the last reload failed or watching the file stopped, null if neither happened
+        // since the last reload that succeeded
+        std::exception_ptr lastError() const;
+        // Whether changes to the file are reloaded without calling reload
+        bool watching() const;
+
+        // Reads the current snapshot of a config from one thread. As long as no new snapshot
+        // has been published, a read is a single atomic load of the version, so readers
+        // neither lock nor write to anything they share with each other.
+        class Reader {
+        public:
+            explicit Reader(const LiveConfig &config);
+
+            // Valid until the next call on this reader
+            const Section& get();
+
+        private:
+            const LiveConfig &config;
+            uint64_t currentVersion;
+            std::shared_ptr<const Section> current;
+        };
+
+    private:
+        const std::string path;
+        const ParseOptions options;
+
+        // Only accessed through std::atomic_load and std::atomic_store
+        std::shared_ptr<const Section> current;
+        std::atomic<uint64_t> published{0};
+
+        // Held while parsing, so reloads happen one at a time
+        mutable std::mutex reloading;
+        std::exception_ptr error;
+
+        std::atomic<bool> watched{false};
+
+#ifdef DCF_INOTIFY
+        int watchFd = -1;
+        // Written to when the watcher has to stop
+        int stopFds[2] = {-1, -1};
+        std::thread watcher;
+
+        void startWatching();
+        void watch();
+        void stopWatching();
+#endif
+
+        std::shared_ptr<const Section> load() const;
+        void publish(std::shared_ptr<const Section> snapshot);
+    };
+} // namespace dcf
+
+
+
+inline dcf::LiveConfig::LiveConfig(const std::string &path, const ParseOptions &options)
+    : path(path), options(options) {
+    publish(load());
+#ifdef DCF_INOTIFY
+    startWatching();
+#endif
+}
+
+
+inline dcf::LiveConfig::~LiveConfig() {
+#ifdef DCF_INOTIFY
+    if(watcher.joinable()) {
+        const char stop = 0;
+        while(::write(stopFds[1], &stop, 1) < 0 && errno == EINTR) { }
+        watcher.join();
+    }
+    for(int fd : {watchFd, stopFds[0], stopFds[1]}) {
+        if(fd >= 0) {
+            ::close(fd);
+        }
+    }
+#endif
+}
+
+
+inline std::shared_ptr<const dcf::Section> dcf::LiveConfig::snapshot() const {
+    return std::atomic_load_explicit(&current, std::memory_order_acquire);
+}
+
+
+inline uint64_t dcf::LiveConfig::version() const {
+    return published.load(std::memory_order_acquire);
+}
+
+
+inline bool dcf::LiveConfig::reload() {
+    std::lock_guard<std::mutex> lock(reloading);
+    try {
+        publish(load());
+        error = nullptr;
+        return true;
+    } catch(...) {
+        error = std::current_exception();
+        return false;
+    }
+}
+
+
+inline std::exception_ptr dcf::LiveConfig::lastError() const {
+    std::lock_guard<std::mutex> lock(reloading);
+    return error;
+}
+
+
+inline bool dcf::LiveConfig::watching() const {
+    return watched.load(std::memory_order_acquire);
+}
+
+
+// The file is read instead of mapped, a mapping would fault if the file got truncated
+// while it is parsed
+inline std::shared_ptr<const dcf::Section> dcf::LiveConfig::load() const {
+    std::ifstream fileStream(path, std::ios::binary);
+    if(!fileStream.is_open()) {
+        throw std::runtime_error("Unable to open file: " + path);
+    }
+    std::ostringstream content;
+    content << fileStream.rdbuf();
+
+    // Lazily parsed values need the text for as long as the snapshot lives
+    const auto text = std::make_shared<const std::string>(content.str());
+    return std::make_shared<const dcf::Section>(internal::parseText(*text, text, options));
+}
+
+
+inline void dcf::LiveConfig::publish(std::shared_ptr<const Section> snapshot) {
+    std::atomic_store_explicit(&current, std::move(snapshot), std::memory_order_release);
+    published.fetch_add(1, std::memory_order_release);
+}
+
+
+#ifdef DCF_INOTIFY
+
+// The directory is watched rather than the file, editors often save by replacing the
+// file with a new one, which a watch on the old file would not see
+inline void dcf::LiveConfig::startWatching() {
+    const size_t slash = path.rfind('/');
+    const std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+
+    // Without a watch, say when the process is out of inotify instances, the config is
+    // still usable through reload
+    watchFd = ::inotify_init1(IN_CLOEXEC);
+    if(watchFd < 0 || ::inotify_add_watch(watchFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0
+        || ::pipe2(stopFds, O_CLOEXEC) < 0) {
+        if(watchFd >= 0) {
+            ::close(watchFd);
+            watchFd = -1;
+        }
+        return;
+    }
+    watched.store(true, std::memory_order_release);
+    watcher = std::thread(&LiveConfig::watch, this);
+}
+
+
+inline void dcf::LiveConfig::watch() {
+    const size_t slash = path.rfind('/');
+    const std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    alignas(inotify_event) char events[4096];
+    pollfd fds[2] = {{watchFd, POLLIN, 0}, {stopFds[0], POLLIN, 0}};
+    while(true) {
+        if(::poll(fds, 2, -1) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            stopWatching();
+            return;
+        }
+        if(fds[1].revents != 0) {
+            return;
+        }
+
+        const ssize_t length = ::read(watchFd, events, sizeof(events));
+        if(length < 0 && errno != EINTR && errno != EAGAIN) {
+            stopWatching();
+            return;
+        }
+        if(length <= 0) {
+            continue;
+        }
+
+        // A single save usually comes as several events, the file is parsed once for all
+        // of them that were read together
+        bool changed = false;
+        for(ssize_t offset = 0; offset < length; ) {
+            const inotify_event *event = reinterpret_cast<const inotify_event*>(events + offset);
+            if(event->len > 0 && name == event->name) {
+                changed = true;
+            }
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        }
+        if(changed) {
+            reload();
+        }
+    }
+}
+
+
+// Changes are no longer picked up, which lastError tells until the next reload
+inline void dcf::LiveConfig::stopWatching() {
+    const std::string reason = std::strerror(errno);
+    std::lock_guard<std::mutex> lock(reloading);
+    error = std::make_exception_ptr(std::runtime_error("Stopped watching file " + path + ": " + reason));
+    watched.store(false, std::memory_order_release);
+}
+
+#endif
+
+
+
+inline dcf::LiveConfig::Reader::Reader(const LiveConfig &config)
+    : config(config), currentVersion(config.version()), current(config.snapshot()) { }
+
+
+inline const dcf::Section& dcf::LiveConfig::Reader::get() {
+    const uint64_t latest = config.version();
+    if(latest != currentVersion) {
+        // Published before its version, so this snapshot is at least as new
+        current = config.snapshot();
+        currentVersion = latest;
+    }
+    return *current;
+}
+
+#endif // LIVE_HPP
@@ -0,0 +1,38 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <cstddef>
+
+namespace dcf {
+    class FunctionRegistry;
+
+    struct ParseOptions {
+        // Only index the nesting of the text up front and parse each section and array the
+        // first time it is accessed. Syntax errors inside a section or array are then only
+        // reported once it is accessed.
+        bool lazy = false;
+
+        // Number of threads the top-level pairs of large documents are split across,
+        // zero for one per hardware thread
+        size_t threads = 1;
+
+        // Sections, arrays and function calls may be nested this deep, the root section
+        // being at depth one
+        size_t maxDepth = 1024;
+
+        // Functions documents may call besides @this, the built-in ones if none are given.
+        // The registry has to outlive the parse.
+        const FunctionRegistry *functions = nullptr;
+    };
+
+
+    struct WriteOptions {
+        // Spaces per nesting level
+        int indent = 4;
+
+        // Leave out headers and all whitespace, so the text is as short as possible
+        bool minified = false;
+    };
+} // namespace dcf
+
+#endif // OPTIONS_HPP
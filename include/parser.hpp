@@ -1,201 +1,633 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include "function.hpp"
+#include "lazy.hpp"
 #include "lexer.hpp"
+#include "options.hpp"
 #include "value.hpp"
 #include "section.hpp"
+#include <cerrno>
+#include <charconv>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 
 namespace dcf::internal {
 
-    class Parser {
-    public:
-        Parser(const std::vector<Token> &tokens);
-        dcf::Section parse();
+    // Taking and matching tokens and turning them into values, shared by everything that
+    // parses the grammar
+    class ParserBase {
+    protected:
+        ParserBase(Lexer &lexer, const dcf::ParseOptions &options);
 
-    private:
-        const std::vector<Token> &tokens;
-        size_t index = -1;
+        Lexer &lexer;
+        const dcf::ParseOptions options;
+        // The token that was taken last. Whitespace is never produced by the lexer,
+        // so it marks that nothing has been taken yet.
+        Token current = Token(Token::Type::WHITESPACE, "", 1, 1);
 
         [[noreturn]] void error(const std::string &expected) const;
 
-        Token matchNextNoComments(const Token::Type expected);
+        const Token& matchNextNoComments(const Token::Type expected);
         bool nextWillMatch(const Token::Type expected);
         bool nextWillMatchNoComments(const Token::Type expected);
 
         bool isAtEnd() const;
 
-        Token next();
-        Token nextNoComments();
-        Token peekNext() const;
-        Token peekNextNoComments() const;
-
-        dcf::Section parseSection();
-        void parsePairList(dcf::Section &section);
-        void parsePair(dcf::Section &section);
-        dcf::Value parseValue();
-        dcf::Value parseArray();
-        void parseValueList(std::vector<dcf::Value> &array);
-        void parseFunction();
+        const Token& next();
+        const Token& nextNoComments();
+        const Token& peekNext();
+        const Token& peekNextNoComments();
 
-        std::string cleanCommentTokenValue(const Token &token);
-        std::string cleanStringTokenValue(const Token &token);
+        std::string_view cleanCommentTokenValue(const Token &token);
+        std::string_view cleanStringTokenValue(const Token &token);
         bool cleanBooleanTokenValue(const Token &token);
         int64_t cleanIntegerTokenValue(const Token &token);
         double cleanDoubleTokenValue(const Token &token);
     };
-} // namespace dcf
 
 
-inline dcf::internal::Parser::Parser(const std::vector<Token> &tokens)
-    : tokens(tokens) { }
+    class Parser : private ParserBase {
+    public:
+        // Lazy and parallel parsing need the indexed source of the lexer's input,
+        // without it everything is parsed right away on the calling thread
+        Parser(Lexer &lexer, const dcf::ParseOptions &options = {}, const dcf::Section::allocator_type &allocator = {},
+            std::shared_ptr<const LazySource> source = nullptr);
+        dcf::Section parse();
+        // Parses input holding just the section or array of a lazy value
+        dcf::Value parseLazy(const LazyValue &lazy);
+
+        // Where a pair of the root section is in the text: from its header or key to the
+        // end of its value, and past the comma after it if there is one
+        struct PairSpan {
+            size_t begin;
+            size_t end;
+            size_t after;
+        };
+        // Parses a document like parse, noting where each pair of the root section is
+        dcf::Section parse(std::vector<PairSpan> &spans);
+        // Parses input holding just some of the pairs of a root section
+        dcf::Section parsePairs(std::vector<PairSpan> &spans);
+
+    private:
+        // Sections and arrays shorter than this are parsed right away, which is cheaper
+        static constexpr size_t LAZY_MIN_LENGTH = 64;
+        // Each thread gets at least this much of the text to parse
+        static constexpr size_t PARALLEL_MIN_LENGTH = 64 * 1024;
+
+        const dcf::Section::allocator_type allocator;
+        const std::shared_ptr<const LazySource> source;
+
+        // A section, array or function call whose elements are being parsed
+        struct Frame {
+            enum class Kind {
+                SECTION,
+                ARRAY,
+                FUNCTION
+            };
+
+            Kind kind;
+            dcf::Section section;
+            std::pmr::vector<dcf::Value> values;
+            // Elements of arrays are packed for as long as they can be, then moved to values
+            dcf::Value::Array::Packed packed;
+            // Key and header of the pair whose value is parsed next, for sections
+            std::string_view key;
+            std::pmr::string header;
+            // Name and position of the call, for functions
+            std::string_view name;
+            size_t line = 0;
+            size_t column = 0;
+
+            Frame(Kind kind, const dcf::Section::allocator_type &allocator);
+        };
+
+        // Nesting is kept track of here instead of on the call stack, so neither long lists
+        // nor deep nesting can run out of stack space
+        std::vector<Frame> stack;
+        // Depth of whatever the input is nested in, for the input of lazy values
+        size_t baseDepth = 0;
+
+        dcf::Section parseSection();
+        void parsePairList(dcf::Section &section);
+        void parsePairList(dcf::Section &section, std::vector<PairSpan> &spans);
+        bool parsePairListInParallel(dcf::Section &section, size_t open);
+        std::vector<size_t> splitPairList(size_t open, size_t close, size_t parts) const;
+        dcf::Value parseArray();
+        void parseElements();
+        bool parseValue(dcf::Value &value);
+        bool deferNext(dcf::Value &value);
+        bool startElement(Frame &frame);
+        void addElement(Frame &frame, dcf::Value &&value);
+        void openFrame(Frame::Kind kind);
+        dcf::Value closeFrame();
+    };
+
+    // Parses a whole document. The owner keeps the text alive for values parsed lazily.
+    dcf::Section parseText(std::string_view text, std::shared_ptr<const void> owner,
+        const dcf::ParseOptions &options, const dcf::Section::allocator_type &allocator = {});
+} // namespace dcf
 
-inline dcf::Section dcf::internal::Parser::parse() {
-    dcf::Section root = parseSection();
-    matchNextNoComments(Token::Type::END_OF_INPUT);
-    return root;
-}
 
-[[noreturn]] inline void dcf::internal::Parser::error(const std::string &expected) const {
-    Token curr = tokens[index];
-    throw dcf::parse_error("Expected " + expected + " but got " + typeToString(curr.type), curr.line, curr.column);
+inline dcf::internal::ParserBase::ParserBase(Lexer &lexer, const dcf::ParseOptions &options)
+    : lexer(lexer), options(options) { }
+
+[[noreturn]] inline void dcf::internal::ParserBase::error(const std::string &expected) const {
+    throw dcf::parse_error("Expected " + expected + " but got " + typeToString(current.type), current.line, current.column);
 }
 
-inline dcf::internal::Token dcf::internal::Parser::matchNextNoComments(const Token::Type expected) {
-    Token curr = nextNoComments();
+inline const dcf::internal::Token& dcf::internal::ParserBase::matchNextNoComments(const Token::Type expected) {
+    const Token &curr = nextNoComments();
     if(curr.type != expected) {
         error(typeToString(expected));
     }
     return curr;
 }
 
-inline bool dcf::internal::Parser::nextWillMatch(const Token::Type expected) {
+inline bool dcf::internal::ParserBase::nextWillMatch(const Token::Type expected) {
     return peekNext().type == expected;
 }
 
-inline bool dcf::internal::Parser::nextWillMatchNoComments(const Token::Type expected) {
+inline bool dcf::internal::ParserBase::nextWillMatchNoComments(const Token::Type expected) {
     return peekNextNoComments().type == expected;
 }
 
-inline bool dcf::internal::Parser::isAtEnd() const {
-    return tokens[index].type == Token::Type::END_OF_INPUT;
+inline bool dcf::internal::ParserBase::isAtEnd() const {
+    return current.type == Token::Type::END_OF_INPUT;
 }
 
-inline dcf::internal::Token dcf::internal::Parser::next() {
-    if(isAtEnd()) {
-        return tokens[index];
+inline const dcf::internal::Token& dcf::internal::ParserBase::next() {
+    if(!isAtEnd()) {
+        current = lexer.next();
     }
-    index++;
-    return tokens[index];
+    return current;
 }
 
-inline dcf::internal::Token dcf::internal::Parser::nextNoComments() {
+inline const dcf::internal::Token& dcf::internal::ParserBase::nextNoComments() {
     if(isAtEnd()) {
-        return tokens[index];
+        return current;
     }
     do {
-        index++;
-    } while(tokens[index].type == Token::Type::COMMENT);
-    return tokens[index];
+        current = lexer.next();
+    } while(current.type == Token::Type::COMMENT);
+    return current;
 }
 
-inline dcf::internal::Token dcf::internal::Parser::peekNext() const {
+inline const dcf::internal::Token& dcf::internal::ParserBase::peekNext() {
     if(isAtEnd()) {
-        return tokens[index];
+        return current;
     }
-    return tokens[index + 1];
+    return lexer.peek();
 }
 
-inline dcf::internal::Token dcf::internal::Parser::peekNextNoComments() const {
+inline const dcf::internal::Token& dcf::internal::ParserBase::peekNextNoComments() {
     if(isAtEnd()) {
-        return tokens[index];
+        return current;
     }
-    size_t nextIndex = index;
-    do {
-        nextIndex++;
-    } while(tokens[nextIndex].type == Token::Type::COMMENT);
-    return tokens[nextIndex];
+    size_t offset = 0;
+    while(lexer.peek(offset).type == Token::Type::COMMENT) {
+        offset++;
+    }
+    return lexer.peek(offset);
+}
+
+inline std::string_view dcf::internal::ParserBase::cleanCommentTokenValue(const Token &token) {
+    std::string_view value = token.value;
+    if(value[1] == '/') {
+        return value.substr(2);
+    }
+    return value.substr(2, value.length() - 4);
+}
+
+inline std::string_view dcf::internal::ParserBase::cleanStringTokenValue(const Token &token) {
+    std::string_view value = token.value;
+    return value.substr(1, value.length() - 2);
+}
+
+inline bool dcf::internal::ParserBase::cleanBooleanTokenValue(const Token &token) {
+    return token.value[0] == 't';
+}
+
+inline int64_t dcf::internal::ParserBase::cleanIntegerTokenValue(const Token &token) {
+    std::string_view value = token.value;
+    Token::Type type = token.type;
+
+    bool negative = value[0] == '-';
+
+    size_t start = negative ? 3 : 2;
+    if(type == Token::Type::NUM_INT) {
+        start -= 2;
+    }
+
+    int base = 10;
+    if(type == Token::Type::NUM_HEX) {
+        base = 16;
+    } else if(type == Token::Type::NUM_BINARY) {
+        base = 2;
+    }
+
+    uint64_t num = 0;
+    const std::from_chars_result result = std::from_chars(value.data() + start, value.data() + value.size(), num, base);
+
+    // Integers have to fit into an int64_t, only hexadecimal and binary ones may use all
+    // 64 bits for their bit pattern
+    const uint64_t limit = negative ? uint64_t(1) << 63 : (type == Token::Type::NUM_INT ? INT64_MAX : UINT64_MAX);
+    if(result.ec == std::errc::result_out_of_range || num > limit) {
+        throw dcf::parse_error("Number out of range", token.line, token.column);
+    }
+
+    if(negative) {
+        return static_cast<int64_t>(0 - num);
+    }
+    return static_cast<int64_t>(num);
+}
+
+inline double dcf::internal::ParserBase::cleanDoubleTokenValue(const Token &token) {
+    std::string_view value = token.value;
+    double num = 0;
+
+#ifdef __cpp_lib_to_chars
+    const std::from_chars_result result = std::from_chars(value.data(), value.data() + value.size(), num);
+    const bool outOfRange = result.ec == std::errc::result_out_of_range;
+#else
+    // Without from_chars for floating point, strtod needs a terminated copy. Usual lengths
+    // fit on the stack.
+    char buffer[64];
+    std::string longValue;
+    const char *terminated = buffer;
+    if(value.size() < sizeof(buffer)) {
+        std::memcpy(buffer, value.data(), value.size());
+        buffer[value.size()] = '\0';
+    } else {
+        longValue = value;
+        terminated = longValue.c_str();
+    }
+    errno = 0;
+    num = std::strtod(terminated, nullptr);
+    // Subnormal results also set ERANGE, but from_chars accepts them
+    const bool outOfRange = errno == ERANGE && (num == 0 || std::isinf(num));
+#endif
+
+    if(outOfRange) {
+        throw dcf::parse_error("Number out of range", token.line, token.column);
+    }
+    return num;
+}
+
+
+inline dcf::internal::Parser::Parser(Lexer &lexer, const dcf::ParseOptions &options,
+    const dcf::Section::allocator_type &allocator, std::shared_ptr<const LazySource> source)
+    : ParserBase(lexer, options), allocator(allocator), source(std::move(source)) { }
+
+inline dcf::internal::Parser::Frame::Frame(Kind kind, const dcf::Section::allocator_type &allocator)
+    : kind(kind), section(allocator), values(allocator), header(allocator) { }
+
+inline dcf::Section dcf::internal::Parser::parse() {
+    const Token &open = matchNextNoComments(Token::Type::L_BRACE);
+    dcf::Section root(allocator);
+    if(!parsePairListInParallel(root, lexer.position(open))) {
+        parsePairList(root);
+    }
+    matchNextNoComments(Token::Type::R_BRACE);
+    matchNextNoComments(Token::Type::END_OF_INPUT);
+    return root;
+}
+
+inline dcf::Section dcf::internal::Parser::parse(std::vector<PairSpan> &spans) {
+    matchNextNoComments(Token::Type::L_BRACE);
+    dcf::Section root(allocator);
+    parsePairList(root, spans);
+    matchNextNoComments(Token::Type::R_BRACE);
+    matchNextNoComments(Token::Type::END_OF_INPUT);
+    return root;
+}
+
+inline dcf::Section dcf::internal::Parser::parsePairs(std::vector<PairSpan> &spans) {
+    dcf::Section section(allocator);
+    parsePairList(section, spans);
+    matchNextNoComments(Token::Type::END_OF_INPUT);
+    return section;
+}
+
+inline dcf::Value dcf::internal::Parser::parseLazy(const LazyValue &lazy) {
+    baseDepth = lazy.depth - 1;
+    // The value itself has to be parsed now, only what is nested in it may be deferred again
+    dcf::Value value = source->text[lazy.begin] == '{' ? dcf::Value(parseSection(), allocator) : parseArray();
+    matchNextNoComments(Token::Type::END_OF_INPUT);
+    return value;
 }
 
 inline dcf::Section dcf::internal::Parser::parseSection() {
     matchNextNoComments(Token::Type::L_BRACE);
-    dcf::Section section;
+    dcf::Section section(allocator);
     parsePairList(section);
     matchNextNoComments(Token::Type::R_BRACE);
     return section;
 }
 
 inline void dcf::internal::Parser::parsePairList(dcf::Section &section) {
-    if(!nextWillMatchNoComments(Token::Type::KEY)) {
-        return;
+    openFrame(Frame::Kind::SECTION);
+    stack.back().section = std::move(section);
+    parseElements();
+    section = std::move(stack.back().section);
+    stack.pop_back();
+}
+
+// Parses the pairs one at a time, with only the nesting in their values left to parseElements,
+// so the position of each of them is known
+inline void dcf::internal::Parser::parsePairList(dcf::Section &section, std::vector<PairSpan> &spans) {
+    openFrame(Frame::Kind::SECTION);
+    const size_t bottom = stack.size() - 1;
+    stack[bottom].section = std::move(section);
+
+    while(nextWillMatchNoComments(Token::Type::KEY)) {
+        const size_t begin = lexer.position(peekNext());
+        startElement(stack[bottom]);
+        dcf::Value value(false);
+        if(!parseValue(value)) {
+            parseElements();
+            value = closeFrame();
+        }
+        const size_t end = lexer.position(current) + current.value.size();
+        addElement(stack[bottom], std::move(value));
+
+        if(!nextWillMatchNoComments(Token::Type::COMMA)) {
+            spans.push_back({begin, end, end});
+            break;
+        }
+        spans.push_back({begin, end, lexer.position(nextNoComments()) + 1});
+    }
+
+    section = std::move(stack[bottom].section);
+    stack.pop_back();
+}
+
+// Splits the pairs of the section opened at the given position into runs of about equal
+// length, parses each run on its own thread and merges the results in order. Returns false
+// if it doesn't parse the pairs, because parsing isn't parallel, the section is too short
+// or there is an error in it. In that case nothing has been taken from the lexer and the
+// pairs have to be parsed as usual, which then also reports the first error.
+inline bool dcf::internal::Parser::parsePairListInParallel(dcf::Section &section, size_t open) {
+    if(options.threads == 1 || source == nullptr) {
+        return false;
+    }
+
+    const size_t close = source->index.closing(open);
+    if(close == std::string_view::npos) {
+        return false;
+    }
+    size_t threads = options.threads == 0 ? std::thread::hardware_concurrency() : options.threads;
+    threads = std::min(threads, (close - open) / PARALLEL_MIN_LENGTH);
+    if(threads < 2) {
+        return false;
     }
-    parsePair(section);
-    if(nextWillMatchNoComments(Token::Type::COMMA)) {
-        nextNoComments();
-        parsePairList(section);
+
+    const std::vector<size_t> cuts = splitPairList(open, close, threads);
+    if(cuts.empty()) {
+        return false;
     }
+
+    // Run i goes from after cut i - 1 up to cut i, with the opening and closing brace
+    // standing in for the cuts at either end
+    struct Run {
+        size_t begin;
+        size_t end;
+        size_t line;
+        size_t column;
+        std::exception_ptr error;
+    };
+    std::vector<Run> runs;
+    runs.reserve(cuts.size() + 1);
+
+    const std::string_view text = source->text;
+    size_t line = current.line;
+    size_t column = current.column + 1;
+    size_t begin = open + 1;
+    for(size_t i = 0; i <= cuts.size(); i++) {
+        runs.push_back({begin, i < cuts.size() ? cuts[i] : close, line, column, nullptr});
+        if(i < cuts.size()) {
+            const simd::NewlineCount newlines = simd::countNewlines(text, begin, cuts[i] + 1);
+            if(newlines.count > 0) {
+                line += newlines.count;
+                column = cuts[i] + 1 - newlines.last;
+            } else {
+                column += cuts[i] + 1 - begin;
+            }
+            begin = cuts[i] + 1;
+        }
+    }
+
+    std::vector<dcf::Section> parts;
+    parts.reserve(runs.size());
+    for(size_t i = 0; i < runs.size(); i++) {
+        parts.emplace_back(allocator);
+    }
+
+    dcf::ParseOptions runOptions = options;
+    runOptions.threads = 1;
+    const auto parseRun = [&](size_t i) {
+        Run &run = runs[i];
+        try {
+            Lexer runLexer(text.substr(0, run.end), run.begin, run.line, run.column);
+            Parser runParser(runLexer, runOptions, allocator, source);
+            runParser.parsePairList(parts[i]);
+            runParser.matchNextNoComments(Token::Type::END_OF_INPUT);
+        } catch(...) {
+            run.error = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(runs.size() - 1);
+    for(size_t i = 1; i < runs.size(); i++) {
+        workers.emplace_back(parseRun, i);
+    }
+    parseRun(0);
+    for(std::thread &worker : workers) {
+        worker.join();
+    }
+
+    for(const Run &run : runs) {
+        if(run.error) {
+            return false;
+        }
+    }
+
+    for(dcf::Section &part : parts) {
+        section.merge(std::move(part));
+    }
+    lexer.skipTo(close);
+    return true;
+}
+
+// Picks the commas between pairs closest after the points that divide the section into
+// equal parts. The last comma is left out, it might be a trailing one with nothing after it.
+inline std::vector<size_t> dcf::internal::Parser::splitPairList(size_t open, size_t close, size_t parts) const {
+    std::vector<size_t> commas = source->index.commas(open);
+    std::vector<size_t> cuts;
+    if(commas.size() < 2) {
+        return cuts;
+    }
+    commas.pop_back();
+
+    for(size_t i = 1; i < parts; i++) {
+        const size_t target = open + (close - open) * i / parts;
+        const auto comma = std::lower_bound(commas.begin(), commas.end(), target);
+        if(comma != commas.end() && (cuts.empty() || *comma > cuts.back())) {
+            cuts.push_back(*comma);
+        }
+    }
+    return cuts;
+}
+
+inline dcf::Value dcf::internal::Parser::parseArray() {
+    matchNextNoComments(Token::Type::L_BRACKET);
+    openFrame(Frame::Kind::ARRAY);
+    parseElements();
+    return closeFrame();
 }
 
-inline void dcf::internal::Parser::parsePair(dcf::Section &section) {
-    std::string header;
-    while(nextWillMatch(Token::Type::COMMENT)) {
-        header += '\n' + cleanCommentTokenValue(next());
+// Skips over the section or array that comes next and makes it a lazy value, unless
+// parsing is not lazy or it is too short to be worth it
+inline bool dcf::internal::Parser::deferNext(dcf::Value &value) {
+    if(!options.lazy || source == nullptr) {
+        return false;
     }
-    Token keyToken = matchNextNoComments(Token::Type::KEY);
-    matchNextNoComments(Token::Type::COLON);
-    dcf::Value value = parseValue();
-    section.set(keyToken.value, value);
-    section.setHeader(keyToken.value, header);
+
+    const size_t begin = lexer.position(peekNextNoComments());
+    const size_t end = source->index.closing(begin);
+    if(end == std::string_view::npos || end - begin < LAZY_MIN_LENGTH) {
+        return false;
+    }
+
+    const Token &open = nextNoComments();
+    const bool isSection = open.type == Token::Type::L_BRACE;
+    value = dcf::Value(allocateShared<LazyValue>(allocator, source, begin, end, open.line, open.column, baseDepth + stack.size() + 1, allocator),
+        isSection ? dcf::ValueType::SECTION : dcf::ValueType::ARRAY);
+
+    lexer.skipTo(end);
+    matchNextNoComments(isSection ? Token::Type::R_BRACE : Token::Type::R_BRACKET);
+    return true;
 }
 
-inline dcf::Value dcf::internal::Parser::parseValue() {
+// Parses the elements of the frame on top of the stack, leaving its closing token.
+// Nested sections, arrays and function calls get frames of their own on top of it.
+inline void dcf::internal::Parser::parseElements() {
+    const size_t bottom = stack.size();
+    if(!startElement(stack.back())) {
+        return;
+    }
+
+    dcf::Value value(false);
+    while(true) {
+        if(!parseValue(value)) {
+            if(startElement(stack.back())) {
+                continue;
+            }
+            value = closeFrame();
+        }
+
+        // Hand the value down until it lands in a frame with another element to parse
+        while(true) {
+            Frame &frame = stack.back();
+            addElement(frame, std::move(value));
+            if(nextWillMatchNoComments(Token::Type::COMMA)) {
+                nextNoComments();
+                if(startElement(frame)) {
+                    break;
+                }
+            }
+            if(stack.size() == bottom) {
+                return;
+            }
+            value = closeFrame();
+        }
+    }
+}
+
+// Parses the next value, unless it is a section, array or function call that is not deferred.
+// Then only its opening is taken, a frame is opened for it and false returned.
+inline bool dcf::internal::Parser::parseValue(dcf::Value &value) {
     switch(peekNextNoComments().type) {
         case Token::Type::STRING:
-            return dcf::Value(cleanStringTokenValue(nextNoComments()));
+            value = dcf::Value(cleanStringTokenValue(nextNoComments()), allocator);
+            return true;
 
         case Token::Type::BOOLEAN:
-            return dcf::Value(cleanBooleanTokenValue(nextNoComments()));
-            break;
+            value = dcf::Value(cleanBooleanTokenValue(nextNoComments()), allocator);
+            return true;
 
         case Token::Type::NUM_INT:
         case Token::Type::NUM_HEX:
         case Token::Type::NUM_BINARY:
-            return dcf::Value(cleanIntegerTokenValue(nextNoComments()));
-            break;
+            value = dcf::Value(cleanIntegerTokenValue(nextNoComments()), allocator);
+            return true;
 
         case Token::Type::NUM_DECIMAL:
-            return dcf::Value(cleanDoubleTokenValue(nextNoComments()));
-            break;
+            value = dcf::Value(cleanDoubleTokenValue(nextNoComments()), allocator);
+            return true;
 
         case Token::Type::L_BRACKET:
-            return parseArray();
-            break;
+            if(deferNext(value)) {
+                return true;
+            }
+            matchNextNoComments(Token::Type::L_BRACKET);
+            openFrame(Frame::Kind::ARRAY);
+            return false;
 
         case Token::Type::L_BRACE:
-            return dcf::Value(parseSection());
-            break;
+            if(deferNext(value)) {
+                return true;
+            }
+            matchNextNoComments(Token::Type::L_BRACE);
+            openFrame(Frame::Kind::SECTION);
+            return false;
+
+        case Token::Type::FUNCTION: {
+            const Token &function = matchNextNoComments(Token::Type::FUNCTION);
+            const std::string_view name = function.value.substr(1);
+            const size_t line = function.line;
+            const size_t column = function.column;
+            matchNextNoComments(Token::Type::L_PAREN);
+            openFrame(Frame::Kind::FUNCTION);
+            stack.back().name = name;
+            stack.back().line = line;
+            stack.back().column = column;
+            return false;
+        }
 
-        case Token::Type::FUNCTION:
-            parseFunction();
-            return dcf::Value("");
-        
         default:
             nextNoComments();
             error("value");
-            break;
     }
 }
 
-inline dcf::Value dcf::internal::Parser::parseArray() {
-    matchNextNoComments(Token::Type::L_BRACKET);
-    std::vector<dcf::Value> array;
-    parseValueList(array);
-    matchNextNoComments(Token::Type::R_BRACKET);
-    return dcf::Value(array);
-}
+// Takes what comes before the next element of the frame, which is the header, key and
+// colon of a pair. Returns false if the frame has no more elements.
+inline bool dcf::internal::Parser::startElement(Frame &frame) {
+    if(frame.kind == Frame::Kind::SECTION) {
+        if(!nextWillMatchNoComments(Token::Type::KEY)) {
+            return false;
+        }
+        frame.header.clear();
+        while(nextWillMatch(Token::Type::COMMENT)) {
+            frame.header += '\n';
+            frame.header += cleanCommentTokenValue(next());
+        }
+        frame.key = matchNextNoComments(Token::Type::KEY).value;
+        matchNextNoComments(Token::Type::COLON);
+        return true;
+    }
 
-inline void dcf::internal::Parser::parseValueList(std::vector<dcf::Value> &array) {
     switch(peekNextNoComments().type) {
         case Token::Type::STRING:
         case Token::Type::BOOLEAN:
@@ -206,70 +638,97 @@ inline void dcf::internal::Parser::parseValueList(std::vector<dcf::Value> &array
         case Token::Type::L_BRACKET:
         case Token::Type::L_BRACE:
         case Token::Type::FUNCTION:
-            break;
+            return true;
         default:
-            return;
+            return false;
     }
-    array.push_back(parseValue());
-    if(nextWillMatchNoComments(Token::Type::COMMA)) {
-        nextNoComments();
-        parseValueList(array);
-    }
-}
-
-inline void dcf::internal::Parser::parseFunction() {
-    matchNextNoComments(Token::Type::FUNCTION);
-    matchNextNoComments(Token::Type::L_PAREN);
-    std::vector<dcf::Value> arguments;
-    parseValueList(arguments);
-    matchNextNoComments(Token::Type::R_PAREN);
 }
 
-inline std::string dcf::internal::Parser::cleanCommentTokenValue(const Token &token) {
-    std::string value = token.value;
-    if(value[1] == '/') {
-        return value.substr(2);
+inline void dcf::internal::Parser::addElement(Frame &frame, dcf::Value &&value) {
+    if(frame.kind == Frame::Kind::SECTION) {
+        frame.section.set(frame.key, std::move(value));
+        frame.section.setHeader(frame.key, frame.header);
+        return;
     }
-    return value.substr(2, value.length() - 4);
-}
-
-inline std::string dcf::internal::Parser::cleanStringTokenValue(const Token &token) {
-    const std::string &value = token.value;
-    return value.substr(1, value.length() - 2);
+    if(frame.kind == Frame::Kind::ARRAY && frame.values.empty() && dcf::Value::Array::append(frame.packed, value, allocator)) {
+        return;
+    }
+    // The first element that cannot be packed along with the others unpacks them all
+    if(frame.packed.index() != 0) {
+        const dcf::Value::Array packed(std::move(frame.packed), allocator);
+        frame.values.reserve(packed.size() + 1);
+        packed.forEach([&frame](auto &&element) {
+            frame.values.push_back(std::forward<decltype(element)>(element));
+        });
+        frame.packed = std::monostate();
+    }
+    frame.values.push_back(std::move(value));
 }
 
-inline bool dcf::internal::Parser::cleanBooleanTokenValue(const Token &token) {
-    return token.value[0] == 't';
+inline void dcf::internal::Parser::openFrame(Frame::Kind kind) {
+    if(baseDepth + stack.size() >= options.maxDepth) {
+        throw dcf::parse_error("Nesting is deeper than " + std::to_string(options.maxDepth) + " levels", current.line, current.column);
+    }
+    stack.emplace_back(kind, allocator);
 }
 
-inline int64_t dcf::internal::Parser::cleanIntegerTokenValue(const Token &token) {
-    const std::string &value = token.value;
-    Token::Type type = token.type;
+// Takes the closing token of the frame on top of the stack and turns it into its value
+inline dcf::Value dcf::internal::Parser::closeFrame() {
+    Frame &frame = stack.back();
+    dcf::Value value(false);
+    switch(frame.kind) {
+        case Frame::Kind::SECTION:
+            matchNextNoComments(Token::Type::R_BRACE);
+            value = dcf::Value(std::move(frame.section), allocator);
+            break;
 
-    bool negative = value[0] == '-';
+        case Frame::Kind::ARRAY:
+            matchNextNoComments(Token::Type::R_BRACKET);
+            if(frame.packed.index() != 0) {
+                value = dcf::Value(allocateShared<dcf::Value::Array>(allocator, std::move(frame.packed), allocator));
+            } else {
+                value = dcf::Value(std::move(frame.values), allocator);
+            }
+            break;
 
-    size_t start = negative ? 3 : 2;
-    if(type == Token::Type::NUM_INT) {
-        start -= 2;
+        case Frame::Kind::FUNCTION:
+            matchNextNoComments(Token::Type::R_PAREN);
+            value = dcf::Value(allocateShared<FunctionCall>(allocator, frame.name, std::move(frame.values), frame.line, frame.column, allocator));
+            break;
     }
+    stack.pop_back();
+    return value;
+}
 
-    int base = 10;
-    if(type == Token::Type::NUM_HEX) {
-        base = 16;
-    } else if(type == Token::Type::NUM_BINARY) {
-        base = 2;
+inline dcf::Section dcf::internal::parseText(std::string_view text, std::shared_ptr<const void> owner,
+    const dcf::ParseOptions &options, const dcf::Section::allocator_type &allocator) {
+    Lexer lexer(text);
+    std::shared_ptr<const LazySource> source;
+    if(options.lazy || options.threads != 1) {
+        // Text that cannot be indexed is malformed, parsing it right away reports the error
+        source = LazySource::create(std::move(owner), text, options);
     }
+    dcf::Section root = Parser(lexer, options, allocator, std::move(source)).parse();
 
-    uint64_t num = std::stoull(value.substr(start), nullptr, base);
-
-    if(negative) {
-        return -static_cast<int64_t>(num);
+    // Without an '@' anywhere there are no function calls to evaluate
+    if(text.find('@') != std::string_view::npos) {
+        Evaluator(root, options, allocator).evaluate();
     }
-    return static_cast<int64_t>(num);
+    return root;
 }
 
-inline double dcf::internal::Parser::cleanDoubleTokenValue(const Token &token) {
-    return std::stod(token.value);
+inline const dcf::Value& dcf::internal::resolve(const LazyValue &lazy) {
+    std::call_once(lazy.parsed, [&lazy]() {
+        std::lock_guard<std::mutex> lock(lazy.source->parsing);
+        // Lex only up to the closing bracket, with the positions being those in the whole text
+        Lexer lexer(lazy.source->text.substr(0, lazy.end + 1), lazy.begin, lazy.line, lazy.column);
+        // With the document's limits, the depth counting on from that of the value
+        dcf::ParseOptions options = lazy.source->options;
+        options.lazy = true;
+        options.threads = 1;
+        lazy.value.emplace(Parser(lexer, options, lazy.allocator, lazy.source).parseLazy(lazy));
+    });
+    return *lazy.value;
 }
 
 #endif //PARSER_HPP
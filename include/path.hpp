@@ -0,0 +1,309 @@
+#ifndef PATH_HPP
+#define PATH_HPP
+
+#include "key.hpp"
+#include "section.hpp"
+#include "value.hpp"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace dcf {
+    namespace internal {
+        class Patcher;
+    } // namespace internal
+
+    // A path to values below a section, compiled once and evaluated any number of times.
+    // Keys are separated by dots and indices of arrays come in brackets, as in "a.b[3].c".
+    // A '*' in place of a key or index stands for all keys of a section or all elements of
+    // an array, as in "servers[*].ports.*".
+    //
+    // Without wildcards, a path remembers where it led in the last section it was evaluated
+    // on, so evaluating it on that section again is a compare and a load while the section
+    // is unchanged. Like a Key, a path can be shared between threads.
+    //
+    // Values are returned as copies in the memory resource of the section, which share the
+    // sections and arrays below them with it. An element of a packed array (see
+    // Value::asIntArray) is built for each call, the array is left as it is.
+    class Path {
+    public:
+        explicit Path(std::string_view expression);
+        Path(const Path &other);
+        Path& operator=(const Path &other);
+
+        std::string_view expression() const;
+
+        // With wildcards, these take the first value found, in the order of the keys and
+        // elements
+        Value get(const Section &section) const;
+        std::optional<Value> find(const Section &section) const;
+        std::vector<Value> findAll(const Section &section) const;
+
+    private:
+        friend class internal::Patcher;
+
+        struct Step {
+            enum class Kind {
+                KEY,
+                INDEX,
+                ANY
+            };
+
+            Kind kind;
+            Key key;
+            size_t index;
+        };
+
+        // Where a path leads, the value itself or an element of it if it is a packed array
+        struct Location {
+            const Value *value;
+            size_t element;
+        };
+
+        // Marks the cache while a thread fills it
+        static constexpr uint64_t FILLING = std::numeric_limits<uint64_t>::max();
+        // The element of a location that is the value itself
+        static constexpr size_t WHOLE = std::numeric_limits<size_t>::max();
+
+        std::string text;
+        std::vector<Step> steps;
+        bool hasWildcards = false;
+
+        // Where the path led in the section of this stamp, zero if nowhere yet. The stamp is
+        // read before and after the value, like a sequence lock.
+        mutable std::atomic<uint64_t> cachedStamp{0};
+        mutable std::atomic<const Value*> cachedValue{nullptr};
+        mutable std::atomic<size_t> cachedElement{WHOLE};
+
+        void compile();
+        Location resolve(const Section &section) const;
+        static const Value* child(const Value &value, const Step &step);
+        static Value load(const Section &section, const Location &location);
+        void collect(const Section &root, const Section &section, size_t position, std::vector<Value> &found) const;
+        void collect(const Section &root, const Value &value, size_t position, std::vector<Value> &found) const;
+        [[noreturn]] void invalid() const;
+    };
+} // namespace dcf
+
+
+
+inline dcf::Path::Path(std::string_view expression)
+    : text(expression) {
+    compile();
+}
+
+inline dcf::Path::Path(const Path &other)
+    : text(other.text), steps(other.steps), hasWildcards(other.hasWildcards) { }
+
+
+inline dcf::Path& dcf::Path::operator=(const Path &other) {
+    if(this != &other) {
+        text = other.text;
+        steps = other.steps;
+        hasWildcards = other.hasWildcards;
+        cachedStamp.store(0, std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+
+inline std::string_view dcf::Path::expression() const {
+    return text;
+}
+
+
+inline dcf::Value dcf::Path::get(const Section &section) const {
+    std::optional<Value> value = find(section);
+    if(!value) {
+        throw std::runtime_error("No value at path " + text);
+    }
+    return std::move(*value);
+}
+
+
+// The cache holds where the path led rather than a value, the copy is made for each call
+inline std::optional<dcf::Value> dcf::Path::find(const Section &section) const {
+    if(hasWildcards) {
+        std::vector<Value> found = findAll(section);
+        return found.empty() ? std::nullopt : std::optional<Value>(std::move(found.front()));
+    }
+
+    const uint64_t stamp = section.stamp();
+    uint64_t seen = cachedStamp.load(std::memory_order_acquire);
+    if(seen == stamp) {
+        const Location location = {cachedValue.load(std::memory_order_relaxed), cachedElement.load(std::memory_order_relaxed)};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(cachedStamp.load(std::memory_order_relaxed) == seen) {
+            return load(section, location);
+        }
+    }
+
+    const Location location = resolve(section);
+    if(location.value == nullptr) {
+        return std::nullopt;
+    }
+    // Threads that find another one filling the cache leave it to that one
+    if(seen != FILLING && cachedStamp.compare_exchange_strong(seen, FILLING, std::memory_order_relaxed)) {
+        std::atomic_thread_fence(std::memory_order_release);
+        cachedValue.store(location.value, std::memory_order_relaxed);
+        cachedElement.store(location.element, std::memory_order_relaxed);
+        cachedStamp.store(stamp, std::memory_order_release);
+    }
+    return load(section, location);
+}
+
+
+inline std::vector<dcf::Value> dcf::Path::findAll(const Section &section) const {
+    std::vector<Value> found;
+    collect(section, section, 0, found);
+    return found;
+}
+
+
+inline void dcf::Path::compile() {
+    const std::string_view expression = text;
+    size_t position = 0;
+    while(true) {
+        // A key or '*' up to the next dot or bracket
+        const size_t end = std::min(expression.find_first_of(".[]", position), expression.size());
+        const std::string_view part = expression.substr(position, end - position);
+        if(part.empty()) {
+            invalid();
+        }
+        const bool any = part == "*";
+        steps.push_back({any ? Step::Kind::ANY : Step::Kind::KEY, Key(any ? "" : part), 0});
+        position = end;
+
+        while(position < expression.size() && expression[position] == '[') {
+            const size_t close = expression.find(']', position);
+            if(close == std::string_view::npos) {
+                invalid();
+            }
+            const std::string_view index = expression.substr(position + 1, close - position - 1);
+            if(index == "*") {
+                steps.push_back({Step::Kind::ANY, Key(""), 0});
+            } else {
+                size_t number = 0;
+                const std::from_chars_result result = std::from_chars(index.data(), index.data() + index.size(), number);
+                if(index.empty() || result.ec != std::errc() || result.ptr != index.data() + index.size()) {
+                    invalid();
+                }
+                steps.push_back({Step::Kind::INDEX, Key(""), number});
+            }
+            position = close + 1;
+        }
+
+        if(position == expression.size()) {
+            break;
+        }
+        if(expression[position] != '.') {
+            invalid();
+        }
+        position++;
+    }
+
+    for(const Step &step : steps) {
+        hasWildcards = hasWildcards || step.kind == Step::Kind::ANY;
+    }
+}
+
+
+// Only the first step is into the section itself, all others are into values. Elements of
+// packed arrays can only be at the last step, there is nothing below them.
+inline dcf::Path::Location dcf::Path::resolve(const Section &section) const {
+    const Value *value = steps[0].kind == Step::Kind::KEY ? section.find(steps[0].key) : nullptr;
+    for(size_t i = 1; i < steps.size() && value != nullptr; i++) {
+        const Step &step = steps[i];
+        if(i + 1 == steps.size() && step.kind == Step::Kind::INDEX && value->getType() == ValueType::ARRAY) {
+            const Value::Array &array = value->arrayContents();
+            if(array.packed.index() != 0) {
+                return {step.index < array.size() ? value : nullptr, step.index};
+            }
+        }
+        value = child(*value, step);
+    }
+    return {value, WHOLE};
+}
+
+
+inline const dcf::Value* dcf::Path::child(const Value &value, const Step &step) {
+    if(step.kind == Step::Kind::KEY && value.getType() == ValueType::SECTION) {
+        return value.asSection().find(step.key);
+    }
+    if(step.kind == Step::Kind::INDEX && value.getType() == ValueType::ARRAY) {
+        const Value::Array &array = value.arrayContents();
+        if(step.index >= array.size() || array.packed.index() != 0) {
+            return nullptr;
+        }
+        return &array.elements[step.index];
+    }
+    return nullptr;
+}
+
+
+inline dcf::Value dcf::Path::load(const Section &section, const Location &location) {
+    if(location.element == WHOLE) {
+        return Value(*location.value, section.allocator);
+    }
+    Value element(false);
+    return location.value->arrayContents().at(location.element, element);
+}
+
+
+// Values are copied into the resource of the root, the section the path is evaluated on
+inline void dcf::Path::collect(const Section &root, const Section &section, size_t position, std::vector<Value> &found) const {
+    const Step &step = steps[position];
+    if(step.kind == Step::Kind::ANY) {
+        for(const Section::Entry &entry : section.read().entries) {
+            if(!entry.removed) {
+                collect(root, entry.value, position + 1, found);
+            }
+        }
+    } else if(const Value *value = step.kind == Step::Kind::KEY ? section.find(step.key) : nullptr) {
+        collect(root, *value, position + 1, found);
+    }
+}
+
+
+inline void dcf::Path::collect(const Section &root, const Value &value, size_t position, std::vector<Value> &found) const {
+    if(position == steps.size()) {
+        found.push_back(load(root, {&value, WHOLE}));
+        return;
+    }
+
+    const Step &step = steps[position];
+    const bool last = position + 1 == steps.size();
+    if(value.getType() == ValueType::SECTION) {
+        collect(root, value.asSection(), position, found);
+    } else if(value.getType() == ValueType::ARRAY && value.arrayContents().packed.index() != 0) {
+        const Value::Array &array = value.arrayContents();
+        if(last && step.kind == Step::Kind::ANY) {
+            array.forEach([&found](auto &&element) {
+                found.emplace_back(std::forward<decltype(element)>(element));
+            });
+        } else if(last && step.kind == Step::Kind::INDEX && step.index < array.size()) {
+            found.push_back(load(root, {&value, step.index}));
+        }
+    } else if(step.kind == Step::Kind::ANY && value.getType() == ValueType::ARRAY) {
+        for(const Value &element : value.arrayContents().elements) {
+            collect(root, element, position + 1, found);
+        }
+    } else if(const Value *next = child(value, step)) {
+        collect(root, *next, position + 1, found);
+    }
+}
+
+
+inline void dcf::Path::invalid() const {
+    throw std::runtime_error("Invalid path: " + text);
+}
+
+#endif // PATH_HPP
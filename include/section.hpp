@@ -1,272 +1,753 @@
 #ifndef SECTION_HPP
 #define SECTION_HPP
 
+#include "key.hpp"
+#include "options.hpp"
 #include "value.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <memory_resource>
 #include <optional>
-#include <unordered_map>
-#include <iomanip>
+#include <ostream>
+#include <string>
 
 
 namespace dcf {
-    class Section {
-    public:
-        Section();
-        Section(const Section& other);
-        Section& operator=(const Section& other);
+    class IncrementalDocument;
 
-        Value get(const std::string &key) const;
-        std::optional<Value> optionalGet(const std::string &key) const;
+    class Path;
 
-        void set(const std::string &key, const Value &value);
-        void set(const std::string &key, const std::string &value);
-        void set(const std::string &key, bool value);
-        void set(const std::string &key, int64_t value);
-        void set(const std::string &key, double value);
-        void set(const std::string &key, const std::vector<Value> &value);
-        void set(const std::string &key, const Section &value);
+    namespace internal {
+        class BinaryWriter;
+        class Evaluator;
+        class Patcher;
+        class Writer;
+    } // namespace internal
+
+    // All keys, headers and values are allocated from the given memory resource,
+    // the default one unless the section belongs to a dcf::Document.
+    class Section {
+    public:
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
 
-        void remove(const std::string &key);
+        Section(const allocator_type &allocator = {});
+        Section(const Section& other, const allocator_type &allocator = {});
+        Section(Section&& other) noexcept;
+        Section(Section&& other, const allocator_type &allocator);
+        Section& operator=(const Section& other);
+        Section& operator=(Section&& other);
+
+        const Value& get(std::string_view key) const;
+        const Value& get(const Key &key) const;
+        const Value* find(std::string_view key) const;
+        const Value* find(const Key &key) const;
+        std::optional<Value> optionalGet(std::string_view key) const;
+        std::optional<Value> optionalGet(const Key &key) const;
+
+        void set(std::string_view key, const Value &value);
+        void set(std::string_view key, Value &&value);
+        void set(std::string_view key, const std::string &value);
+        void set(std::string_view key, bool value);
+        void set(std::string_view key, int64_t value);
+        void set(std::string_view key, double value);
+        void set(std::string_view key, const std::vector<Value> &value);
+        void set(std::string_view key, std::vector<Value> &&value);
+        void set(std::string_view key, const Section &value);
+        void set(std::string_view key, Section &&value);
+
+        void remove(std::string_view key);
+        // Moves the entries of the other section over as if they were set one after another
+        void merge(Section &&other);
         std::vector<std::string> keys() const;
 
-        void setHeader(const std::string &key, const std::string &header);
-        std::string getHeader(const std::string &key) const;
+        void setHeader(std::string_view key, std::string_view header);
+        std::string getHeader(std::string_view key) const;
+
+        // Hash of the keys and values, but not the headers, independent of the order of the
+        // keys. Computed once and kept until the section is changed, copies share it.
+        uint64_t fingerprint() const;
+        // Sections are equal if they have the same keys with equal values, in any order and
+        // whatever their headers. Sections with different fingerprints are not compared any
+        // further, nor are copies that haven't been changed since.
+        bool operator==(const Section &other) const;
+        bool operator!=(const Section &other) const;
 
         std::string toString(int indent = 4) const;
+        std::string toString(const WriteOptions &options) const;
+        // Appends the text of the section to the buffer
+        void write(std::string &buffer, const WriteOptions &options = {}) const;
+        // Writes the text of the section to the stream in blocks of a few kilobytes
+        void write(std::ostream &out, const WriteOptions &options = {}) const;
 
     private:
-        std::vector<std::string> keyOrder;
-        std::unordered_map<std::string, std::pair<std::string, Value>> map;
-
-        void trim(std::string &text) const;
-        void indentWithComments(std::string &text, const std::string &spacePrefix) const;
-        std::string toArrayString(const Value &value, int indent, int depth) const;
-        std::string valueString(const Value &value, int indent, int depth) const;
-        std::string toString(int indent, int depth) const;
+        // The entries are kept contiguously in insertion order. Removed entries stay in
+        // place as tombstones until they make up half of the section, then it is compacted.
+        struct Entry {
+            using allocator_type = Section::allocator_type;
+
+            std::pmr::string key;
+            std::pmr::string header;
+            Value value;
+            size_t hash;
+            bool removed = false;
+
+            Entry(std::string_view key, size_t hash, Value &&value, const allocator_type &allocator);
+            Entry(const Entry &other, const allocator_type &allocator);
+            Entry(Entry &&other) noexcept;
+            Entry(Entry &&other, const allocator_type &allocator);
+            Entry& operator=(const Entry &other) = default;
+            Entry& operator=(Entry &&other) = default;
+        };
+
+        // Copies of a section share their contents until one of them is changed, which then
+        // gets contents of its own. The entries are copied then, but the sections and arrays
+        // in their values stay shared, so changing a copy only copies the sections on the
+        // way to what is changed.
+        struct Contents {
+            using allocator_type = Section::allocator_type;
+
+            std::pmr::vector<Entry> entries;
+            // Open addressing table of entry positions plus one, zero marks a free slot.
+            // Empty as long as the section is small enough for a linear scan.
+            std::pmr::vector<uint32_t> index;
+            size_t removedCount = 0;
+            // Zero until computed, and again whenever the contents are written to
+            mutable std::atomic<uint64_t> fingerprint{0};
+            // Zero until asked for, see stamp
+            mutable std::atomic<uint64_t> stamp{0};
+
+            Contents(const allocator_type &allocator);
+            Contents(const Contents &other, const allocator_type &allocator);
+        };
+
+        // Sections up to this size are searched linearly, larger ones get a hash index
+        static constexpr size_t LINEAR_SCAN_LIMIT = 8;
+        static constexpr size_t NOT_FOUND = static_cast<size_t>(-1);
+
+        allocator_type allocator;
+        // Null while the section is empty and has never been changed
+        std::shared_ptr<Contents> contents;
+
+        const Contents& read() const;
+        Contents& write();
+        bool sharesResourceWith(const Section &other) const;
+        uint64_t stamp() const;
+
+        size_t locate(std::string_view key) const;
+        size_t locate(std::string_view key, size_t hash) const;
+        size_t locate(const Key &key) const;
+        void insert(std::string_view key, Value &&value);
+        void indexAppended();
+        void insertIndex(size_t position);
+        void rebuildIndex();
+        void compact();
+
+        friend class IncrementalDocument;
+        friend class Path;
+        friend class Value;
+        friend class internal::BinaryWriter;
+        friend class internal::Evaluator;
+        friend class internal::Patcher;
+        friend class internal::Writer;
     };
 } // namespace dcf
 
 
 
-inline dcf::Section::Section() { }
+inline dcf::Section::Section(const allocator_type &allocator)
+    : allocator(allocator) { }
+
+// Contents are shared within one memory resource. Into another one, the entries are copied
+// and their values copy the sections and arrays below them in turn.
+inline dcf::Section::Section(const Section& other, const allocator_type &allocator)
+    : allocator(allocator) {
+    if(other.contents != nullptr) {
+        contents = sharesResourceWith(other) ? other.contents
+            : internal::allocateShared<Contents>(allocator, *other.contents, allocator);
+    }
+}
+
+inline dcf::Section::Section(Section&& other) noexcept
+    : allocator(other.allocator), contents(std::move(other.contents)) { }
+
+inline dcf::Section::Section(Section&& other, const allocator_type &allocator)
+    : Section(other, allocator) {
+    other.contents = nullptr;
+}
+
+
+inline dcf::Section::Entry::Entry(std::string_view key, size_t hash, Value &&value, const allocator_type &allocator)
+    : key(key, allocator), header(allocator), value(std::move(value), allocator), hash(hash) { }
+
+inline dcf::Section::Entry::Entry(const Entry &other, const allocator_type &allocator)
+    : key(other.key, allocator), header(other.header, allocator), value(other.value, allocator),
+    hash(other.hash), removed(other.removed) { }
+
+inline dcf::Section::Entry::Entry(Entry &&other) noexcept
+    : key(std::move(other.key)), header(std::move(other.header)), value(std::move(other.value)),
+    hash(other.hash), removed(other.removed) { }
+
+inline dcf::Section::Entry::Entry(Entry &&other, const allocator_type &allocator)
+    : key(std::move(other.key), allocator), header(std::move(other.header), allocator), value(std::move(other.value), allocator),
+    hash(other.hash), removed(other.removed) { }
 
-inline dcf::Section::Section(const Section& other)
-    : keyOrder(other.keyOrder), map(other.map) { }
 
+inline dcf::Section::Contents::Contents(const allocator_type &allocator)
+    : entries(allocator), index(allocator) { }
 
+inline dcf::Section::Contents::Contents(const Contents &other, const allocator_type &allocator)
+    : entries(other.entries, allocator), index(other.index, allocator), removedCount(other.removedCount) { }
+
+
+
+// Assigned sections keep their own memory resource, so contents are only shared within one
 inline dcf::Section& dcf::Section::operator=(const Section& other) {
     if(this != &other) {
-        keyOrder = other.keyOrder;
-        map = other.map;
+        *this = Section(other, allocator);
+    }
+    return *this;
+}
+
+
+inline dcf::Section& dcf::Section::operator=(Section&& other) {
+    if(this != &other) {
+        if(sharesResourceWith(other)) {
+            contents = std::move(other.contents);
+        } else {
+            contents = Section(other, allocator).contents;
+            other.contents = nullptr;
+        }
     }
     return *this;
 }
 
 
-inline dcf::Value dcf::Section::get(const std::string &key) const {
-    auto it = map.find(key);
-    if(it == map.end()) {
-        throw std::runtime_error("Key not found: " + key);
+inline const dcf::Value& dcf::Section::get(std::string_view key) const {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        throw std::runtime_error("Key not found: " + std::string(key));
+    }
+    return read().entries[position].value;
+}
+
+
+inline const dcf::Value& dcf::Section::get(const Key &key) const {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        throw std::runtime_error("Key not found: " + key.keyName);
+    }
+    return read().entries[position].value;
+}
+
+
+inline const dcf::Value* dcf::Section::find(std::string_view key) const {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        return nullptr;
     }
-    return it->second.second;
+    return &read().entries[position].value;
 }
 
 
-inline std::optional<dcf::Value> dcf::Section::optionalGet(const std::string &key) const {
-    auto it = map.find(key);
-    if(it == map.end()) {
+inline const dcf::Value* dcf::Section::find(const Key &key) const {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        return nullptr;
+    }
+    return &read().entries[position].value;
+}
+
+
+inline std::optional<dcf::Value> dcf::Section::optionalGet(std::string_view key) const {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        return std::nullopt;
+    }
+    return read().entries[position].value;
+}
+
+
+inline std::optional<dcf::Value> dcf::Section::optionalGet(const Key &key) const {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
         return std::nullopt;
     }
-    return it->second.second;
+    return read().entries[position].value;
 }
 
 
-inline void dcf::Section::set(const std::string &key, const dcf::Value &value) {
-    auto it = map.find(key);
-    if(it == map.end()) {
-        keyOrder.push_back(key);
-        map.insert({key, {"", value}});
+inline void dcf::Section::set(std::string_view key, const dcf::Value &value) {
+    set(key, Value(value, allocator));
+}
+
+
+// Values from another memory resource are copied into this section's
+inline void dcf::Section::set(std::string_view key, dcf::Value &&value) {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        insert(key, std::move(value));
     } else {
-        it->second.second = value;
+        write().entries[position].value = Value(std::move(value), allocator);
     }
 }
 
 
-inline void dcf::Section::set(const std::string &key, const std::string &value) {
+inline void dcf::Section::set(std::string_view key, const std::string &value) {
     set(key, Value(value));
 }
 
 
-inline void dcf::Section::set(const std::string &key, bool value) {
+inline void dcf::Section::set(std::string_view key, bool value) {
     set(key, Value(value));
 }
 
 
-inline void dcf::Section::set(const std::string &key, int64_t value) {
+inline void dcf::Section::set(std::string_view key, int64_t value) {
     set(key, Value(value));
 }
 
 
-inline void dcf::Section::set(const std::string &key, double value) {
+inline void dcf::Section::set(std::string_view key, double value) {
     set(key, Value(value));
 }
 
 
-inline void dcf::Section::set(const std::string &key, const std::vector<dcf::Value> &value) {
+inline void dcf::Section::set(std::string_view key, const std::vector<dcf::Value> &value) {
     set(key, Value(value));
 }
 
 
-inline void dcf::Section::set(const std::string &key, const dcf::Section &value) {
+inline void dcf::Section::set(std::string_view key, std::vector<dcf::Value> &&value) {
+    set(key, Value(std::move(value)));
+}
+
+
+inline void dcf::Section::set(std::string_view key, const dcf::Section &value) {
     set(key, Value(value));
 }
 
 
-inline void dcf::Section::remove(const std::string &key) {
-    keyOrder.erase(std::find(keyOrder.begin(), keyOrder.end(), key));
-    map.erase(key);
+inline void dcf::Section::set(std::string_view key, dcf::Section &&value) {
+    set(key, Value(std::move(value)));
+}
+
+
+inline void dcf::Section::remove(std::string_view key) {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        throw std::runtime_error("Key not found: " + std::string(key));
+    }
+
+    // Index slots of removed entries are left alone, lookups just probe past them
+    Contents &own = write();
+    Entry &entry = own.entries[position];
+    entry.removed = true;
+    entry.value = Value(false);
+    own.removedCount++;
+
+    if(own.removedCount * 2 > own.entries.size()) {
+        compact();
+    }
+}
+
+
+inline void dcf::Section::merge(Section &&other) {
+    if(other.contents == nullptr) {
+        return;
+    }
+    if(contents == nullptr || read().entries.empty()) {
+        *this = std::move(other);
+        other.contents = nullptr;
+        return;
+    }
+
+    // Entries can only be moved out of contents no other section shares
+    Contents &source = other.write();
+    Contents &own = write();
+    own.entries.reserve(own.entries.size() + source.entries.size());
+    for(Entry &entry : source.entries) {
+        if(entry.removed) {
+            continue;
+        }
+        const size_t position = locate(entry.key, entry.hash);
+        if(position == NOT_FOUND) {
+            own.entries.push_back(std::move(entry));
+            indexAppended();
+        } else {
+            own.entries[position].value = Value(std::move(entry.value), allocator);
+            own.entries[position].header = std::move(entry.header);
+        }
+    }
+    other.contents = nullptr;
 }
 
 
 inline std::vector<std::string> dcf::Section::keys() const {
-    return keyOrder;
+    const Contents &own = read();
+    std::vector<std::string> keys;
+    keys.reserve(own.entries.size() - own.removedCount);
+    for(const Entry &entry : own.entries) {
+        if(!entry.removed) {
+            keys.emplace_back(entry.key);
+        }
+    }
+    return keys;
 }
 
 
-inline void dcf::Section::setHeader(const std::string &key, const std::string &header) {
-    auto it = map.find(key);
-    if(it == map.end()) {
-        throw std::runtime_error("Key not found: " + key);
+inline void dcf::Section::setHeader(std::string_view key, std::string_view header) {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        throw std::runtime_error("Key not found: " + std::string(key));
     }
-    it->second.first = header;
+    write().entries[position].header = header;
 }
 
 
-inline std::string dcf::Section::getHeader(const std::string &key) const {
-    auto it = map.find(key);
-    if(it == map.end()) {
-        throw std::runtime_error("Key not found: " + key);
+inline std::string dcf::Section::getHeader(std::string_view key) const {
+    size_t position = locate(key);
+    if(position == NOT_FOUND) {
+        throw std::runtime_error("Key not found: " + std::string(key));
     }
-    return it->second.first;
+    return std::string(read().entries[position].header);
 }
 
 
-inline std::string dcf::Section::toString(int indent) const {
-    if(indent < 0) {
-        throw std::range_error("Indent cannot be smaller than zero");
+// Entries are hashed on their own and summed up, which keeps the order out of it
+inline uint64_t dcf::Section::fingerprint() const {
+    const Contents &own = read();
+    uint64_t hash = own.fingerprint.load(std::memory_order_relaxed);
+    if(hash != 0) {
+        return hash;
+    }
+    for(const Entry &entry : own.entries) {
+        if(!entry.removed) {
+            hash += internal::mixHash(entry.hash ^ internal::mixHash(entry.value.fingerprint()));
+        }
     }
-    return toString(indent, 1);
+    hash = internal::mixHash(hash + own.entries.size() - own.removedCount);
+    hash = hash == 0 ? 1 : hash;
+    own.fingerprint.store(hash, std::memory_order_relaxed);
+    return hash;
 }
 
 
-inline void dcf::Section::trim(std::string &text) const {
-    auto first = std::find_if_not(text.begin(), text.end(),
-        [](unsigned char ch) { return std::isspace(ch); });
-    text.erase(text.begin(), first);
+inline bool dcf::Section::operator==(const Section &other) const {
+    if(contents == other.contents) {
+        return true;
+    }
+    const Contents &own = read();
+    const Contents &others = other.read();
+    if(own.entries.size() - own.removedCount != others.entries.size() - others.removedCount
+        || fingerprint() != other.fingerprint()) {
+        return false;
+    }
+    for(const Entry &entry : own.entries) {
+        if(entry.removed) {
+            continue;
+        }
+        const size_t position = other.locate(entry.key, entry.hash);
+        if(position == NOT_FOUND || others.entries[position].value != entry.value) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    auto last = std::find_if_not(text.rbegin(), text.rend(),
-        [](unsigned char ch) { return std::isspace(ch); }).base();
-    text.erase(last, text.end());
+
+inline bool dcf::Section::operator!=(const Section &other) const {
+    return !(*this == other);
 }
 
 
-inline void dcf::Section::indentWithComments(std::string &text, const std::string &spacePrefix) const {
-    trim(text);
+inline const dcf::Section::Contents& dcf::Section::read() const {
+    if(contents == nullptr) {
+        static const Contents empty{allocator_type()};
+        return empty;
+    }
+    return *contents;
+}
 
-    std::string result;
-    size_t start = 0;
-    size_t end = text.find('\n');
 
-    while(end != std::string::npos) {
-        result.append(text, start, end - start);
-        result += "\n" + spacePrefix + "// ";
-        start = end + 1;
-        while(start < text.size() && (text[start] == ' ' || text[start] == '\t')) {
-            start++;
-        }
-        end = text.find('\n', start);
+// Contents of this section alone, copied first if they are shared
+inline dcf::Section::Contents& dcf::Section::write() {
+    if(contents == nullptr) {
+        contents = internal::allocateShared<Contents>(allocator, allocator);
+    } else if(contents.use_count() > 1) {
+        contents = internal::allocateShared<Contents>(allocator, *contents, allocator);
     }
-    if(start < text.size()) {
-        result.append(text, start, std::string::npos);
+    contents->fingerprint.store(0, std::memory_order_relaxed);
+    contents->stamp.store(0, std::memory_order_relaxed);
+    return *contents;
+}
+
+
+inline bool dcf::Section::sharesResourceWith(const Section &other) const {
+    return *allocator.resource() == *other.allocator.resource();
+}
+
+
+// Identifies the contents until they are next written to. Stamps are handed out from one
+// counter, so no two contents ever get the same one. Sections below are only ever changed
+// by setting them again, so the stamp of the root stands for the whole tree.
+inline uint64_t dcf::Section::stamp() const {
+    static std::atomic<uint64_t> next{1};
+    const Contents &own = read();
+    uint64_t stamp = own.stamp.load(std::memory_order_relaxed);
+    if(stamp == 0) {
+        const uint64_t fresh = next.fetch_add(1, std::memory_order_relaxed);
+        // Another thread may have handed out one first, then its stamp is kept
+        stamp = own.stamp.compare_exchange_strong(stamp, fresh, std::memory_order_relaxed) ? fresh : stamp;
     }
+    return stamp;
+}
 
-    text = std::move(result);
+
+inline size_t dcf::Section::locate(std::string_view key) const {
+    const Contents &own = read();
+    if(own.index.empty()) {
+        for(size_t i = 0; i < own.entries.size(); i++) {
+            if(!own.entries[i].removed && own.entries[i].key == key) {
+                return i;
+            }
+        }
+        return NOT_FOUND;
+    }
+    return locate(key, internal::hashKey(key));
 }
 
 
-inline std::string dcf::Section::toArrayString(const dcf::Value &value, int indent, int depth) const {
-    std::ostringstream output;
-    const std::string spacePrefix(indent * depth, ' ');
+inline size_t dcf::Section::locate(std::string_view key, size_t hash) const {
+    const Contents &own = read();
+    if(own.index.empty()) {
+        for(size_t i = 0; i < own.entries.size(); i++) {
+            if(own.entries[i].hash == hash && !own.entries[i].removed && own.entries[i].key == key) {
+                return i;
+            }
+        }
+        return NOT_FOUND;
+    }
+
+    const size_t mask = own.index.size() - 1;
+    for(size_t slot = hash & mask; own.index[slot] != 0; slot = (slot + 1) & mask) {
+        const Entry &entry = own.entries[own.index[slot] - 1];
+        if(entry.hash == hash && !entry.removed && entry.key == key) {
+            return own.index[slot] - 1;
+        }
+    }
+    return NOT_FOUND;
+}
+
 
-    output << "[\n";
+inline size_t dcf::Section::locate(const Key &key) const {
+    const Contents &own = read();
+    const size_t hint = key.positionHint.load(std::memory_order_relaxed);
+    if(hint < own.entries.size()) {
+        const Entry &entry = own.entries[hint];
+        if(entry.hash == key.hash && !entry.removed && entry.key == key.name()) {
+            return hint;
+        }
+    }
 
-    const std::vector<dcf::Value> &list = value.asArray();
-    for(const dcf::Value &val : list) {
-        output << spacePrefix << valueString(val, indent, depth + 1) << ",\n";
+    const size_t position = locate(key.name(), key.hash);
+    if(position != NOT_FOUND) {
+        key.positionHint.store(static_cast<uint32_t>(position), std::memory_order_relaxed);
     }
+    return position;
+}
+
 
-    if(!list.empty()) {
-        std::string str = output.str();
-        str.erase(str.end() - 2);
-        return str + std::string(indent * (depth - 1), ' ') + ']';
+inline void dcf::Section::insert(std::string_view key, dcf::Value &&value) {
+    write().entries.emplace_back(key, internal::hashKey(key), std::move(value));
+    indexAppended();
+}
+
+
+// The following change the contents in place, write has to have been called before
+inline void dcf::Section::indexAppended() {
+    Contents &own = *contents;
+    if(own.entries.size() > LINEAR_SCAN_LIMIT) {
+        // Keep the table at most half full
+        if(own.entries.size() * 2 > own.index.size()) {
+            rebuildIndex();
+        } else {
+            insertIndex(own.entries.size() - 1);
+        }
     }
+}
+
 
-    output.seekp(-1, std::ios_base::end);
-    output << ']';
-    return output.str();
+inline void dcf::Section::insertIndex(size_t position) {
+    Contents &own = *contents;
+    const size_t mask = own.index.size() - 1;
+    size_t slot = own.entries[position].hash & mask;
+    while(own.index[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    own.index[slot] = static_cast<uint32_t>(position + 1);
 }
 
 
-inline std::string dcf::Section::valueString(const dcf::Value &value, int indent, int depth) const {
-    switch(value.getType()) {
-        case dcf::ValueType::STRING:
-            return '"' + value.asString() + '"';
-        case dcf::ValueType::BOOLEAN:
-            return value.asBool() ? "true" : "false";
-        case dcf::ValueType::INTEGER:
-            return std::to_string(value.asInt());
-        case dcf::ValueType::DOUBLE: {
-            std::ostringstream sstream;
-            sstream << std::setprecision(15) << value.asDouble();
-            return sstream.str();
+inline void dcf::Section::rebuildIndex() {
+    Contents &own = *contents;
+    own.index.clear();
+    if(own.entries.size() <= LINEAR_SCAN_LIMIT) {
+        return;
+    }
+
+    size_t capacity = 16;
+    while(capacity < own.entries.size() * 4) {
+        capacity *= 2;
+    }
+    own.index.resize(capacity);
+
+    for(size_t i = 0; i < own.entries.size(); i++) {
+        if(!own.entries[i].removed) {
+            insertIndex(i);
         }
-        case dcf::ValueType::ARRAY:
-            return toArrayString(value, indent, depth);
-        case dcf::ValueType::SECTION:
-            return value.asSection().toString(indent, depth);
     }
 }
 
 
-inline std::string dcf::Section::toString(int indent, int depth) const {
-    std::ostringstream output;
-    const std::string spacePrefix(indent * depth, ' ');
+inline void dcf::Section::compact() {
+    Contents &own = *contents;
+    own.entries.erase(std::remove_if(own.entries.begin(), own.entries.end(),
+        [](const Entry &entry) { return entry.removed; }), own.entries.end());
+    own.removedCount = 0;
+    rebuildIndex();
+}
+
+
+
+// Values need sections to be complete to copy them and to get at their fingerprints
+
+inline dcf::Value::Value(const dcf::Section &section, const allocator_type &allocator)
+    : type(ValueType::SECTION), data(internal::allocateShared<dcf::Section>(allocator, section, allocator)) { }
+
+inline dcf::Value::Value(dcf::Section &&section, const allocator_type &allocator)
+    : type(ValueType::SECTION), data(internal::allocateShared<dcf::Section>(allocator, std::move(section), allocator)) { }
+
+
+// Sections are shared within one memory resource. The copy into another one copies its
+// entries with their values in turn, so nothing below it is left in the old resource.
+inline std::shared_ptr<dcf::Section> dcf::Value::copySection(const allocator_type &allocator, const std::shared_ptr<Section> &section) {
+    if(*section->allocator.resource() == *allocator.resource()) {
+        return section;
+    }
+    return internal::allocateShared<Section>(allocator, *section, allocator);
+}
+
+
+inline uint64_t dcf::Value::fingerprint() const {
+    if(auto lazy = std::get_if<std::shared_ptr<const internal::LazyValue>>(&data)) {
+        return internal::resolve(**lazy).fingerprint();
+    }
 
-    output << "{\n";
+    // Keeps values of different types apart when their contents hash the same
+    const uint64_t seed = (static_cast<uint64_t>(type) + 1) * 0x9e3779b97f4a7c15ULL;
+    switch(type) {
+        case ValueType::STRING:
+            return internal::mixHash(seed ^ internal::hashKey(asString()));
+
+        case ValueType::BOOLEAN:
+            return internal::mixHash(seed ^ static_cast<uint64_t>(asBool()));
+
+        case ValueType::INTEGER:
+            return internal::mixHash(seed ^ static_cast<uint64_t>(asInt()));
+
+        case ValueType::DOUBLE: {
+            // Values that compare equal have to hash the same, so there is one zero and one NaN
+            double number = asDouble();
+            if(number == 0.0) {
+                number = 0.0;
+            } else if(std::isnan(number)) {
+                number = std::numeric_limits<double>::quiet_NaN();
+            }
+            uint64_t bits;
+            std::memcpy(&bits, &number, sizeof(bits));
+            return internal::mixHash(seed ^ bits);
+        }
 
-    bool firstElement = true;
-    for(const std::string &key : keyOrder) {
-        const auto &value = map.at(key);
-        if(!value.first.empty()) {
-            std::string header = value.first;
-            indentWithComments(header, spacePrefix);
-            if(!firstElement) {
-                output << '\n';
+        case ValueType::ARRAY: {
+            const Array &array = *std::get<std::shared_ptr<Array>>(data);
+            uint64_t hash = array.fingerprint.load(std::memory_order_relaxed);
+            if(hash == 0) {
+                hash = seed;
+                array.forEach([&hash](const Value &element) {
+                    hash = internal::mixHash(hash + element.fingerprint());
+                });
+                hash = hash == 0 ? 1 : hash;
+                array.fingerprint.store(hash, std::memory_order_relaxed);
             }
-            output << spacePrefix << "// " << header << '\n';
+            return hash;
         }
-        output << spacePrefix << key << ": " << valueString(value.second, indent, depth + 1) << ",\n";
-        firstElement = false;
+
+        case ValueType::SECTION:
+            return asSection().fingerprint();
     }
+    return seed;
+}
+
 
-    if(!keyOrder.empty()) {
-        std::string str = output.str();
-        str.erase(str.end() - 2);
-        return str + std::string(indent * (depth - 1), ' ') + '}';
+inline bool dcf::Value::operator==(const Value &other) const {
+    if(type != other.type) {
+        return false;
     }
 
-    output.seekp(-1, std::ios_base::end);
-    output << '}';
-    return output.str();
+    switch(type) {
+        case ValueType::STRING:
+            return asString() == other.asString();
+
+        case ValueType::BOOLEAN:
+            return asBool() == other.asBool();
+
+        case ValueType::INTEGER:
+            return asInt() == other.asInt();
+
+        case ValueType::DOUBLE:
+            return asDouble() == other.asDouble() || (std::isnan(asDouble()) && std::isnan(other.asDouble()));
+
+        case ValueType::ARRAY: {
+            const Array &array = arrayContents();
+            const Array &others = other.arrayContents();
+            if(&array == &others) {
+                return true;
+            }
+            if(array.size() != others.size() || fingerprint() != other.fingerprint()) {
+                return false;
+            }
+            // Packed elements are compared as they are, without values for them
+            if(array.packed.index() != 0 && array.packed.index() == others.packed.index()) {
+                return std::visit([&others](const auto &elements) {
+                    using T = std::decay_t<decltype(elements)>;
+                    if constexpr(std::is_same_v<T, std::pmr::vector<double>>) {
+                        return std::equal(elements.begin(), elements.end(), std::get<T>(others.packed).begin(),
+                            [](double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); });
+                    } else if constexpr(std::is_same_v<T, std::monostate>) {
+                        return true;
+                    } else {
+                        return elements == std::get<T>(others.packed);
+                    }
+                }, array.packed);
+            }
+            Value element(false);
+            Value otherElement(false);
+            for(size_t i = 0; i < array.size(); i++) {
+                if(array.at(i, element) != others.at(i, otherElement)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        case ValueType::SECTION:
+            return asSection() == other.asSection();
+    }
+    return false;
 }
 
 #endif // SECTION_HPP
@@ -0,0 +1,156 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstdint>
+#include <string_view>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    #include <immintrin.h>
+    #define DCF_SIMD
+#endif
+
+
+// Bulk scanning kernels for the lexer. The input is processed in blocks of 16 (SSE2) or
+// 32 (AVX2) bytes, each block being turned into a bit mask with one bit per matching byte.
+// Whatever is left at the end of the input, or everything if neither instruction set is
+// available, goes through the plain scalar loops.
+namespace dcf::internal::simd {
+
+#if defined(__AVX2__)
+    using Block = __m256i;
+    using Mask = uint32_t;
+    constexpr size_t BLOCK_SIZE = 32;
+    // One bit for each byte of a block
+    constexpr Mask BLOCK_MASK = 0xFFFFFFFF;
+
+    inline Block load(const char *data) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    }
+
+    inline Mask equal(Block block, char c) {
+        return static_cast<Mask>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(c))));
+    }
+
+    inline Mask whitespace(Block block) {
+        // '\t' to '\r' are contiguous, so (c - '\t') <= 4 as unsigned covers them
+        const Block shifted = _mm256_sub_epi8(block, _mm256_set1_epi8('\t'));
+        const Block control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+        return equal(block, ' ') | static_cast<Mask>(_mm256_movemask_epi8(control));
+    }
+
+#elif defined(__SSE2__)
+    using Block = __m128i;
+    using Mask = uint32_t;
+    constexpr size_t BLOCK_SIZE = 16;
+    // One bit for each byte of a block, the upper half of the mask is unused
+    constexpr Mask BLOCK_MASK = 0xFFFF;
+
+    inline Block load(const char *data) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    }
+
+    inline Mask equal(Block block, char c) {
+        return static_cast<Mask>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c))));
+    }
+
+    inline Mask whitespace(Block block) {
+        // '\t' to '\r' are contiguous, so (c - '\t') <= 4 as unsigned covers them
+        const Block shifted = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+        const Block control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+        return equal(block, ' ') | static_cast<Mask>(_mm_movemask_epi8(control));
+    }
+#endif
+
+
+    inline bool isWhitespace(char c) {
+        return c == ' ' || (static_cast<unsigned char>(c - '\t') <= 4);
+    }
+
+
+    // Position of the first byte at or after pos that is not whitespace, or the input size
+    inline size_t findNonWhitespace(std::string_view input, size_t pos) {
+#ifdef DCF_SIMD
+        for(; pos + BLOCK_SIZE <= input.size(); pos += BLOCK_SIZE) {
+            const Mask mask = ~whitespace(load(input.data() + pos)) & BLOCK_MASK;
+            if(mask != 0) {
+                return pos + __builtin_ctz(mask);
+            }
+        }
+#endif
+        while(pos < input.size() && isWhitespace(input[pos])) {
+            pos++;
+        }
+        return pos;
+    }
+
+
+    // Position of the first byte at or after pos that is either a or b, or npos
+    inline size_t findEither(std::string_view input, size_t pos, char a, char b) {
+#ifdef DCF_SIMD
+        for(; pos + BLOCK_SIZE <= input.size(); pos += BLOCK_SIZE) {
+            const Block block = load(input.data() + pos);
+            const Mask mask = equal(block, a) | equal(block, b);
+            if(mask != 0) {
+                return pos + __builtin_ctz(mask);
+            }
+        }
+#endif
+        for(; pos < input.size(); pos++) {
+            if(input[pos] == a || input[pos] == b) {
+                return pos;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+
+    // Position of the first byte at or after pos that is any of the given characters, or npos
+    template<char... Chars>
+    inline size_t findAny(std::string_view input, size_t pos) {
+#ifdef DCF_SIMD
+        for(; pos + BLOCK_SIZE <= input.size(); pos += BLOCK_SIZE) {
+            const Block block = load(input.data() + pos);
+            const Mask mask = (equal(block, Chars) | ...);
+            if(mask != 0) {
+                return pos + __builtin_ctz(mask);
+            }
+        }
+#endif
+        for(; pos < input.size(); pos++) {
+            if(((input[pos] == Chars) || ...)) {
+                return pos;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+
+    struct NewlineCount {
+        size_t count = 0;
+        size_t last = std::string_view::npos;
+    };
+
+    // Number of '\n' in [begin, end) and the position of the last one
+    inline NewlineCount countNewlines(std::string_view input, size_t begin, size_t end) {
+        NewlineCount result;
+        size_t pos = begin;
+#ifdef DCF_SIMD
+        for(; pos + BLOCK_SIZE <= end; pos += BLOCK_SIZE) {
+            const Mask mask = equal(load(input.data() + pos), '\n');
+            if(mask != 0) {
+                result.count += __builtin_popcount(mask);
+                result.last = pos + (31 - __builtin_clz(mask));
+            }
+        }
+#endif
+        for(; pos < end; pos++) {
+            if(input[pos] == '\n') {
+                result.count++;
+                result.last = pos;
+            }
+        }
+        return result;
+    }
+} // namespace dcf::internal::simd
+
+#endif // SIMD_HPP
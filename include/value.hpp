@@ -1,11 +1,67 @@
 #ifndef VALUE_HPP
 #define VALUE_HPP
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <variant>
+#include <vector>
 
 
 namespace dcf {
     class Section;
+    class Value;
+
+    namespace internal {
+        class BinaryWriter;
+        class Evaluator;
+        class Parser;
+        class Patcher;
+        class Writer;
+        struct FunctionCall;
+        struct LazyValue;
+
+        // Parses a lazy section or array on first use, defined along with the parser
+        inline const Value& resolve(const LazyValue &lazy);
+        // The memory resource a lazy section or array is parsed into, defined along with it
+        inline std::pmr::memory_resource* resourceOf(const LazyValue &lazy);
+
+        // Allocates from a memory resource like std::pmr::polymorphic_allocator, but constructs
+        // with just the arguments given. A polymorphic_allocator would add itself to them for
+        // types that take an allocator, these are given theirs explicitly instead.
+        template<typename T>
+        class SharedAllocator {
+        public:
+            using value_type = T;
+
+            explicit SharedAllocator(std::pmr::memory_resource *resource);
+            template<typename U>
+            SharedAllocator(const SharedAllocator<U> &other);
+
+            T* allocate(size_t count);
+            void deallocate(T *pointer, size_t count);
+
+            template<typename U>
+            bool operator==(const SharedAllocator<U> &other) const;
+            template<typename U>
+            bool operator!=(const SharedAllocator<U> &other) const;
+
+        private:
+            template<typename U>
+            friend class SharedAllocator;
+
+            std::pmr::memory_resource *resource;
+        };
+
+        // A T in the memory resource of the allocator, built from exactly the arguments
+        template<typename T, typename... Args>
+        std::shared_ptr<T> allocateShared(const std::pmr::polymorphic_allocator<std::byte> &allocator, Args&&... args);
+    } // namespace internal
 
     enum class ValueType {
         STRING,
@@ -16,17 +72,49 @@ namespace dcf {
         SECTION
     };
 
+    // A view of elements that are next to each other in memory, like a C++20 std::span
+    template<typename T>
+    class ArrayView {
+    public:
+        ArrayView(const T *first, size_t count);
+
+        const T* data() const;
+        size_t size() const;
+        bool empty() const;
+        const T* begin() const;
+        const T* end() const;
+        const T& operator[](size_t index) const;
+
+    private:
+        const T *first;
+        size_t count;
+    };
+
+    // Strings, arrays and nested sections are allocated from the given memory resource,
+    // the default one unless the value belongs to a dcf::Document. A copy into another
+    // memory resource copies everything below the value, so it may outlive the original.
     class Value {
     public:
-        Value(const Value& other);
-        Value(const std::string &text);
-        Value(bool boolean);
-        Value(int64_t num_integer);
-        Value(double num_double);
-        Value(const std::vector<Value> &array);
-        Value(const Section &section);
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+        Value(const Value& other, const allocator_type &allocator = {});
+        Value(Value&& other) noexcept;
+        Value(Value&& other, const allocator_type &allocator);
+        Value(std::string_view text, const allocator_type &allocator = {});
+        Value(const std::string &text, const allocator_type &allocator = {});
+        Value(const char *text, const allocator_type &allocator = {});
+        Value(bool boolean, const allocator_type &allocator = {});
+        Value(int64_t num_integer, const allocator_type &allocator = {});
+        Value(double num_double, const allocator_type &allocator = {});
+        Value(const std::vector<Value> &array, const allocator_type &allocator = {});
+        Value(std::vector<Value> &&array, const allocator_type &allocator = {});
+        Value(const std::pmr::vector<Value> &array, const allocator_type &allocator = {});
+        Value(std::pmr::vector<Value> &&array, const allocator_type &allocator = {});
+        Value(const Section &section, const allocator_type &allocator = {});
+        Value(Section &&section, const allocator_type &allocator = {});
 
         Value& operator=(const Value& other);
+        Value& operator=(Value&& other);
 
         ValueType getType() const;
 
@@ -34,45 +122,213 @@ namespace dcf {
         bool asBool() const;
         int64_t asInt() const;
         double asDouble() const;
-        const std::vector<Value>& asArray() const;
+        // A copy of the elements, made on each call. Arrays of only integers, only doubles or
+        // only booleans are kept packed, without a Value for each element, so their elements
+        // are built for the copy. The views below read the elements in place instead.
+        std::vector<Value> asArray() const;
         const Section& asSection() const;
+        // Views of the elements, valid as long as the array is. asValueArray is for arrays
+        // that are not packed. They throw for arrays of anything else, empty arrays give
+        // empty views. Booleans are viewed as bytes that are 0 or 1.
+        ArrayView<int64_t> asIntArray() const;
+        ArrayView<double> asDoubleArray() const;
+        ArrayView<uint8_t> asBoolArray() const;
+        ArrayView<Value> asValueArray() const;
+
+        // Hash of the type and contents of the value. Sections and arrays remember theirs,
+        // so it is only computed once for all copies of them. Defined along with Section.
+        uint64_t fingerprint() const;
+        // Compares contents, with sections compared as in Section::operator==. A NaN equals
+        // itself. Values with different fingerprints are not compared any further.
+        bool operator==(const Value &other) const;
+        bool operator!=(const Value &other) const;
 
     private:
+        friend class Path;
+        friend class internal::BinaryWriter;
+        friend class internal::Evaluator;
+        friend class internal::Parser;
+        friend class internal::Patcher;
+        friend class internal::Writer;
+
+        struct Array;
+
         ValueType type;
+        // Copies of a value within one memory resource share its section or array, which is
+        // never changed while it is shared. Copies into another one copy it along with all
+        // sections and arrays below it. Sections and arrays of a lazily parsed document start
+        // out as a LazyValue, which is parsed before it is copied into another resource.
+        // Function calls only exist between parsing a document and evaluating it.
         std::variant<
             std::string,
             bool,
             int64_t,
             double,
-            std::vector<Value>,
-            std::shared_ptr<Section>
+            std::shared_ptr<Array>,
+            std::shared_ptr<Section>,
+            std::shared_ptr<const internal::LazyValue>,
+            std::shared_ptr<internal::FunctionCall>
         > data;
 
+        Value(std::shared_ptr<const internal::LazyValue> lazy, ValueType type);
+        Value(std::shared_ptr<internal::FunctionCall> call);
+        Value(std::shared_ptr<Array> array);
+
+        template<typename... Args>
+        static std::shared_ptr<Array> makeArray(const allocator_type &allocator, Args&&... args);
+        static std::shared_ptr<Array> copyArray(const allocator_type &allocator, const Array &array);
+        // Defined along with Section
+        static std::shared_ptr<Section> copySection(const allocator_type &allocator, const std::shared_ptr<Section> &section);
+        const Array& arrayContents() const;
+
         void checkType(ValueType expected) const;
     };
-} // namespace dcf
 
 
-inline dcf::Value::Value(const Value& other) 
-    : type(other.type), data(other.data) { }
+    // The elements of an array value, shared by all its copies along with the fingerprint
+    // once that is known
+    struct Value::Array {
+        // Booleans are packed as bytes, std::vector<bool> cannot be viewed in place
+        using Packed = std::variant<std::monostate, std::pmr::vector<int64_t>, std::pmr::vector<double>, std::pmr::vector<uint8_t>>;
+        // The type of the values that packed elements of type T stand for
+        template<typename T>
+        using Element = std::conditional_t<std::is_same_v<T, uint8_t>, bool, T>;
+
+        // Empty for packed arrays
+        std::pmr::vector<Value> elements;
+        // All elements, when they are all integers, all doubles or all booleans
+        Packed packed;
+        // Zero until computed
+        mutable std::atomic<uint64_t> fingerprint{0};
+
+        // Packs the elements if it can
+        explicit Array(std::pmr::vector<Value> &&elements);
+        Array(Packed &&packed, const allocator_type &allocator);
+        Array(const Array &other, const allocator_type &allocator);
+
+        size_t size() const;
+        // The element at the index, without unpacking the array. A packed element is built
+        // into the given value, which is returned then.
+        const Value& at(size_t index, Value &packedElement) const;
+        template<typename T>
+        ArrayView<T> view() const;
+        // Hands each element to the visitor, packed ones as temporary values. Nothing is kept
+        // of those, an array is never unpacked to be read.
+        template<typename Visitor>
+        void forEach(Visitor &&visitor) const;
+
+        // These change the array in place, it must not be shared with any other value.
+        // They drop the fingerprint.
+        void pack();
+        void set(size_t index, Value &&value);
+
+        // Adds the value to elements packed so far. Returns false if it cannot be packed
+        // along with them, which leaves them as they are.
+        static bool append(Packed &packed, const Value &value, const allocator_type &allocator);
+    };
+} // namespace dcf
 
-inline dcf::Value::Value(const std::string &text)
-    : type(ValueType::STRING), data(text) { }
 
-inline dcf::Value::Value(bool boolean)
+inline dcf::Value::Value(const Value& other, const allocator_type &allocator)
+    : type(other.type), data(std::visit([&allocator](const auto &value) -> decltype(data) {
+        using T = std::decay_t<decltype(value)>;
+        const std::pmr::memory_resource &resource = *allocator.resource();
+        if constexpr(std::is_same_v<T, std::shared_ptr<Array>>) {
+            if(*value->elements.get_allocator().resource() == resource) {
+                return value;
+            }
+            return copyArray(allocator, *value);
+        } else if constexpr(std::is_same_v<T, std::shared_ptr<Section>>) {
+            return copySection(allocator, value);
+        } else if constexpr(std::is_same_v<T, std::shared_ptr<const internal::LazyValue>>) {
+            if(*internal::resourceOf(*value) == resource) {
+                return value;
+            }
+            return Value(internal::resolve(*value), allocator).data;
+        } else {
+            return value;
+        }
+    }, other.data)) { }
+
+inline dcf::Value::Value(Value&& other) noexcept
+    : type(other.type), data(std::move(other.data)) { }
+
+// Only what stays in the same memory resource is moved, everything else is copied
+inline dcf::Value::Value(Value&& other, const allocator_type &allocator)
+    : type(other.type), data(std::visit([&allocator](auto &value) -> decltype(data) {
+        using T = std::decay_t<decltype(value)>;
+        const std::pmr::memory_resource &resource = *allocator.resource();
+        if constexpr(std::is_same_v<T, std::shared_ptr<Array>>) {
+            if(*value->elements.get_allocator().resource() == resource) {
+                return std::move(value);
+            }
+            return copyArray(allocator, *value);
+        } else if constexpr(std::is_same_v<T, std::shared_ptr<Section>>) {
+            return copySection(allocator, value);
+        } else if constexpr(std::is_same_v<T, std::shared_ptr<const internal::LazyValue>>) {
+            if(*internal::resourceOf(*value) == resource) {
+                return std::move(value);
+            }
+            return Value(internal::resolve(*value), allocator).data;
+        } else {
+            return std::move(value);
+        }
+    }, other.data)) { }
+
+// Strings are std::strings of their own in any memory resource, so asString can hand them out
+inline dcf::Value::Value(std::string_view text, const allocator_type&)
+    : type(ValueType::STRING), data(std::in_place_type<std::string>, text) { }
+
+inline dcf::Value::Value(const std::string &text, const allocator_type &allocator)
+    : Value(std::string_view(text), allocator) { }
+
+inline dcf::Value::Value(const char *text, const allocator_type &allocator)
+    : Value(std::string_view(text), allocator) { }
+
+inline dcf::Value::Value(bool boolean, const allocator_type&)
     : type(ValueType::BOOLEAN), data(boolean) { }
 
-inline dcf::Value::Value(int64_t num_integer)
+inline dcf::Value::Value(int64_t num_integer, const allocator_type&)
     : type(ValueType::INTEGER), data(num_integer) { }
 
-inline dcf::Value::Value(double num_double)
+inline dcf::Value::Value(double num_double, const allocator_type&)
     : type(ValueType::DOUBLE), data(num_double) { }
 
-inline dcf::Value::Value(const std::vector<Value> &array)
-    : type(ValueType::ARRAY), data(array) { }
+inline dcf::Value::Value(const std::vector<Value> &array, const allocator_type &allocator)
+    : type(ValueType::ARRAY), data(makeArray(allocator, array.begin(), array.end())) { }
+
+inline dcf::Value::Value(std::vector<Value> &&array, const allocator_type &allocator)
+    : type(ValueType::ARRAY), data(makeArray(allocator, std::make_move_iterator(array.begin()), std::make_move_iterator(array.end()))) { }
+
+inline dcf::Value::Value(const std::pmr::vector<Value> &array, const allocator_type &allocator)
+    : type(ValueType::ARRAY), data(makeArray(allocator, array)) { }
 
-inline dcf::Value::Value(const dcf::Section &section)
-    : type(ValueType::SECTION), data(std::make_shared<dcf::Section>(section)) { }
+inline dcf::Value::Value(std::pmr::vector<Value> &&array, const allocator_type &allocator)
+    : type(ValueType::ARRAY), data(makeArray(allocator, std::move(array))) { }
+
+
+inline dcf::Value::Value(std::shared_ptr<const internal::LazyValue> lazy, ValueType type)
+    : type(type), data(std::move(lazy)) { }
+
+// Calls pass for strings until they are evaluated, that is what they used to be parsed as
+inline dcf::Value::Value(std::shared_ptr<internal::FunctionCall> call)
+    : type(ValueType::STRING), data(std::move(call)) { }
+
+
+inline dcf::Value::Value(std::shared_ptr<Array> array)
+    : type(ValueType::ARRAY), data(std::move(array)) { }
+
+
+// The elements are built with the allocator and then moved into the array
+template<typename... Args>
+std::shared_ptr<dcf::Value::Array> dcf::Value::makeArray(const allocator_type &allocator, Args&&... args) {
+    return internal::allocateShared<Array>(allocator, std::pmr::vector<Value>(std::forward<Args>(args)..., allocator));
+}
+
+
+inline std::shared_ptr<dcf::Value::Array> dcf::Value::copyArray(const allocator_type &allocator, const Array &array) {
+    return internal::allocateShared<Array>(allocator, array, allocator);
+}
 
 
 inline dcf::Value& dcf::Value::operator=(const Value& other) {
@@ -84,6 +340,15 @@ inline dcf::Value& dcf::Value::operator=(const Value& other) {
 }
 
 
+inline dcf::Value& dcf::Value::operator=(Value&& other) {
+    if(this != &other) {
+        type = other.type;
+        data = std::move(other.data);
+    }
+    return *this;
+}
+
+
 inline dcf::ValueType dcf::Value::getType() const {
     return type;
 }
@@ -113,22 +378,288 @@ inline double dcf::Value::asDouble() const {
 }
 
 
-inline const std::vector<dcf::Value>& dcf::Value::asArray() const {
-    checkType(ValueType::ARRAY);
-    return std::get<std::vector<Value>>(data);
+inline std::vector<dcf::Value> dcf::Value::asArray() const {
+    const Array &array = arrayContents();
+    std::vector<Value> elements;
+    elements.reserve(array.size());
+    array.forEach([&elements](auto &&element) {
+        elements.emplace_back(std::forward<decltype(element)>(element));
+    });
+    return elements;
+}
+
+
+inline dcf::ArrayView<int64_t> dcf::Value::asIntArray() const {
+    return arrayContents().view<int64_t>();
+}
+
+
+inline dcf::ArrayView<double> dcf::Value::asDoubleArray() const {
+    return arrayContents().view<double>();
+}
+
+
+inline dcf::ArrayView<uint8_t> dcf::Value::asBoolArray() const {
+    return arrayContents().view<uint8_t>();
+}
+
+
+inline dcf::ArrayView<dcf::Value> dcf::Value::asValueArray() const {
+    const Array &array = arrayContents();
+    if(array.packed.index() != 0) {
+        throw std::runtime_error("Type mismatch");
+    }
+    return ArrayView<Value>(array.elements.data(), array.elements.size());
 }
 
 
 inline const dcf::Section& dcf::Value::asSection() const {
     checkType(ValueType::SECTION);
+    if(auto lazy = std::get_if<std::shared_ptr<const internal::LazyValue>>(&data)) {
+        return internal::resolve(**lazy).asSection();
+    }
     return *std::get<std::shared_ptr<Section>>(data);
 }
 
 
+inline bool dcf::Value::operator!=(const Value &other) const {
+    return !(*this == other);
+}
+
+
+inline const dcf::Value::Array& dcf::Value::arrayContents() const {
+    checkType(ValueType::ARRAY);
+    if(auto lazy = std::get_if<std::shared_ptr<const internal::LazyValue>>(&data)) {
+        return internal::resolve(**lazy).arrayContents();
+    }
+    return *std::get<std::shared_ptr<Array>>(data);
+}
+
+
 inline void dcf::Value::checkType(ValueType expected) const {
     if(type != expected) {
         throw std::runtime_error("Type mismatch");
     }
 }
 
+
+
+inline dcf::Value::Array::Array(std::pmr::vector<Value> &&elements)
+    : elements(std::move(elements)) {
+    pack();
+}
+
+inline dcf::Value::Array::Array(Packed &&packed, const allocator_type &allocator)
+    : elements(allocator), packed(std::move(packed)) { }
+
+inline dcf::Value::Array::Array(const Array &other, const allocator_type &allocator)
+    : elements(allocator) {
+    std::visit([this, &other, &allocator](const auto &packedElements) {
+        using T = std::decay_t<decltype(packedElements)>;
+        if constexpr(std::is_same_v<T, std::monostate>) {
+            elements.assign(other.elements.begin(), other.elements.end());
+        } else {
+            packed.emplace<T>(packedElements, allocator);
+        }
+    }, other.packed);
+}
+
+
+inline size_t dcf::Value::Array::size() const {
+    return std::visit([this](const auto &packedElements) {
+        using T = std::decay_t<decltype(packedElements)>;
+        if constexpr(std::is_same_v<T, std::monostate>) {
+            return elements.size();
+        } else {
+            return packedElements.size();
+        }
+    }, packed);
+}
+
+
+inline const dcf::Value& dcf::Value::Array::at(size_t index, Value &packedElement) const {
+    return std::visit([this, index, &packedElement](const auto &packedElements) -> const Value& {
+        using T = std::decay_t<decltype(packedElements)>;
+        if constexpr(std::is_same_v<T, std::monostate>) {
+            return elements[index];
+        } else {
+            packedElement = Value(static_cast<Element<typename T::value_type>>(packedElements[index]));
+            return packedElement;
+        }
+    }, packed);
+}
+
+
+template<typename T>
+dcf::ArrayView<T> dcf::Value::Array::view() const {
+    if(auto packedElements = std::get_if<std::pmr::vector<T>>(&packed)) {
+        return ArrayView<T>(packedElements->data(), packedElements->size());
+    }
+    if(packed.index() == 0 && elements.empty()) {
+        return ArrayView<T>(nullptr, 0);
+    }
+    throw std::runtime_error("Type mismatch");
+}
+
+
+template<typename Visitor>
+void dcf::Value::Array::forEach(Visitor &&visitor) const {
+    std::visit([this, &visitor](const auto &packedElements) {
+        using T = std::decay_t<decltype(packedElements)>;
+        if constexpr(std::is_same_v<T, std::monostate>) {
+            for(const Value &element : elements) {
+                visitor(element);
+            }
+        } else {
+            for(const typename T::value_type element : packedElements) {
+                visitor(Value(static_cast<Element<typename T::value_type>>(element)));
+            }
+        }
+    }, packed);
+}
+
+
+inline void dcf::Value::Array::pack() {
+    fingerprint.store(0, std::memory_order_relaxed);
+    if(packed.index() != 0 || elements.empty()) {
+        return;
+    }
+    Packed candidate;
+    for(const Value &element : elements) {
+        if(!append(candidate, element, elements.get_allocator())) {
+            return;
+        }
+    }
+    packed = std::move(candidate);
+    elements = std::pmr::vector<Value>(elements.get_allocator());
+}
+
+
+// An element of the type the array is packed with is replaced in place, any other one
+// unpacks the array
+inline void dcf::Value::Array::set(size_t index, Value &&value) {
+    fingerprint.store(0, std::memory_order_relaxed);
+    const bool replaced = std::visit([index, &value](auto &packedElements) {
+        using T = std::decay_t<decltype(packedElements)>;
+        if constexpr(std::is_same_v<T, std::monostate>) {
+            return false;
+        } else {
+            const auto element = std::get_if<Element<typename T::value_type>>(&value.data);
+            if(element != nullptr) {
+                packedElements[index] = *element;
+            }
+            return element != nullptr;
+        }
+    }, packed);
+    if(replaced) {
+        return;
+    }
+    if(packed.index() != 0) {
+        std::pmr::vector<Value> unpacked(elements.get_allocator());
+        unpacked.reserve(size());
+        forEach([&unpacked](auto &&element) {
+            unpacked.push_back(std::forward<decltype(element)>(element));
+        });
+        elements = std::move(unpacked);
+        packed = std::monostate();
+    }
+    elements[index] = std::move(value);
+    pack();
+}
+
+
+inline bool dcf::Value::Array::append(Packed &packed, const Value &value, const allocator_type &allocator) {
+    return std::visit([&packed, &allocator](const auto &element) {
+        using T = std::decay_t<decltype(element)>;
+        if constexpr(std::is_same_v<T, int64_t> || std::is_same_v<T, double> || std::is_same_v<T, bool>) {
+            using Stored = std::conditional_t<std::is_same_v<T, bool>, uint8_t, T>;
+            if(packed.index() == 0) {
+                packed.emplace<std::pmr::vector<Stored>>(allocator);
+            }
+            const auto packedElements = std::get_if<std::pmr::vector<Stored>>(&packed);
+            if(packedElements != nullptr) {
+                packedElements->push_back(element);
+            }
+            return packedElements != nullptr;
+        } else {
+            return false;
+        }
+    }, value.data);
+}
+
+
+
+template<typename T>
+dcf::internal::SharedAllocator<T>::SharedAllocator(std::pmr::memory_resource *resource)
+    : resource(resource) { }
+
+template<typename T>
+template<typename U>
+dcf::internal::SharedAllocator<T>::SharedAllocator(const SharedAllocator<U> &other)
+    : resource(other.resource) { }
+
+template<typename T>
+T* dcf::internal::SharedAllocator<T>::allocate(size_t count) {
+    return static_cast<T*>(resource->allocate(count * sizeof(T), alignof(T)));
+}
+
+template<typename T>
+void dcf::internal::SharedAllocator<T>::deallocate(T *pointer, size_t count) {
+    resource->deallocate(pointer, count * sizeof(T), alignof(T));
+}
+
+template<typename T>
+template<typename U>
+bool dcf::internal::SharedAllocator<T>::operator==(const SharedAllocator<U> &other) const {
+    return *resource == *other.resource;
+}
+
+template<typename T>
+template<typename U>
+bool dcf::internal::SharedAllocator<T>::operator!=(const SharedAllocator<U> &other) const {
+    return !(*this == other);
+}
+
+
+template<typename T, typename... Args>
+std::shared_ptr<T> dcf::internal::allocateShared(const std::pmr::polymorphic_allocator<std::byte> &allocator, Args&&... args) {
+    return std::allocate_shared<T>(SharedAllocator<T>(allocator.resource()), std::forward<Args>(args)...);
+}
+
+
+
+template<typename T>
+dcf::ArrayView<T>::ArrayView(const T *first, size_t count)
+    : first(first), count(count) { }
+
+template<typename T>
+const T* dcf::ArrayView<T>::data() const {
+    return first;
+}
+
+template<typename T>
+size_t dcf::ArrayView<T>::size() const {
+    return count;
+}
+
+template<typename T>
+bool dcf::ArrayView<T>::empty() const {
+    return count == 0;
+}
+
+template<typename T>
+const T* dcf::ArrayView<T>::begin() const {
+    return first;
+}
+
+template<typename T>
+const T* dcf::ArrayView<T>::end() const {
+    return first + count;
+}
+
+template<typename T>
+const T& dcf::ArrayView<T>::operator[](size_t index) const {
+    return first[index];
+}
+
 #endif // VALUE_HPP
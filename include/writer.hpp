@@ -0,0 +1,294 @@
+#ifndef WRITER_HPP
+#define WRITER_HPP
+
+#include "options.hpp"
+#include "section.hpp"
+#include "value.hpp"
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+
+namespace dcf::internal {
+
+    void writeInteger(std::string &buffer, int64_t num);
+    void writeDouble(std::string &buffer, double num);
+
+
+    // Writes sections as text into a single buffer. With a stream given, the buffer is
+    // handed on to it whenever it has filled up, so it never grows much beyond that.
+    class Writer {
+    public:
+        Writer(std::string &buffer, const dcf::WriteOptions &options, std::ostream *out = nullptr);
+
+        void write(const dcf::Section &section);
+
+    protected:
+        // The layout shared with the writer of bound structs
+        std::string &buffer;
+        const dcf::WriteOptions options;
+
+        void open(char bracket);
+        void close(char bracket, int depth);
+        void writeKey(std::string_view key, int depth);
+        void writeSeparator(bool last);
+        void writeIndent(int depth);
+        void flush();
+
+    private:
+        static constexpr size_t FLUSH_SIZE = 64 * 1024;
+
+        std::ostream *out;
+
+        void writeSection(const dcf::Section &section, int depth);
+        void writeArray(const dcf::Value::Array &array, int depth);
+        void writeValue(const dcf::Value &value, int depth);
+        void writeHeader(std::string_view header, int depth);
+    };
+} // namespace dcf::internal
+
+
+
+inline void dcf::internal::writeInteger(std::string &buffer, int64_t num) {
+    char number[24];
+    buffer.append(number, std::to_chars(number, number + sizeof(number), num).ptr);
+}
+
+
+// Same as writing with a precision of 15 to a stream, that is printf's %.15g
+inline void dcf::internal::writeDouble(std::string &buffer, double num) {
+    char number[32];
+#ifdef __cpp_lib_to_chars
+    buffer.append(number, std::to_chars(number, number + sizeof(number), num, std::chars_format::general, 15).ptr);
+#else
+    // Without to_chars for floating point, like the parser falls back to strtod
+    const int length = std::snprintf(number, sizeof(number), "%.15g", num);
+    buffer.append(number, static_cast<size_t>(length));
+#endif
+}
+
+
+inline dcf::internal::Writer::Writer(std::string &buffer, const dcf::WriteOptions &options, std::ostream *out)
+    : buffer(buffer), options(options), out(out) {
+    if(options.indent < 0) {
+        throw std::range_error("Indent cannot be smaller than zero");
+    }
+}
+
+
+inline void dcf::internal::Writer::write(const dcf::Section &section) {
+    writeSection(section, 1);
+    if(out != nullptr) {
+        out->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+}
+
+
+// Depth is the nesting level of the section's pairs, the closing brace goes one level less deep
+inline void dcf::internal::Writer::writeSection(const dcf::Section &section, int depth) {
+    using Entry = dcf::Section::Entry;
+
+    const Entry *last = nullptr;
+    for(const Entry &entry : section.read().entries) {
+        if(!entry.removed) {
+            last = &entry;
+        }
+    }
+    if(last == nullptr) {
+        buffer += "{}";
+        return;
+    }
+
+    open('{');
+    bool firstElement = true;
+    for(const Entry &entry : section.read().entries) {
+        if(entry.removed) {
+            continue;
+        }
+        // Minified text has no comments
+        if(!options.minified && !entry.header.empty()) {
+            if(!firstElement) {
+                buffer += '\n';
+            }
+            writeIndent(depth);
+            buffer += "// ";
+            writeHeader(entry.header, depth);
+            buffer += '\n';
+        }
+        writeKey(entry.key, depth);
+        writeValue(entry.value, depth + 1);
+        writeSeparator(&entry == last);
+        firstElement = false;
+        flush();
+    }
+    close('}', depth);
+}
+
+
+// Packed arrays are written straight from their packed elements
+inline void dcf::internal::Writer::writeArray(const dcf::Value::Array &array, int depth) {
+    const size_t count = array.size();
+    if(count == 0) {
+        buffer += "[]";
+        return;
+    }
+
+    open('[');
+    size_t i = 0;
+    array.forEach([this, depth, count, &i](const dcf::Value &element) {
+        writeIndent(depth);
+        writeValue(element, depth + 1);
+        writeSeparator(++i == count);
+        flush();
+    });
+    close(']', depth);
+}
+
+
+inline void dcf::internal::Writer::writeValue(const dcf::Value &value, int depth) {
+    switch(value.getType()) {
+        case dcf::ValueType::STRING:
+            buffer += '"';
+            buffer += value.asString();
+            buffer += '"';
+            break;
+
+        case dcf::ValueType::BOOLEAN:
+            buffer += value.asBool() ? "true" : "false";
+            break;
+
+        case dcf::ValueType::INTEGER:
+            writeInteger(buffer, value.asInt());
+            break;
+
+        case dcf::ValueType::DOUBLE:
+            writeDouble(buffer, value.asDouble());
+            break;
+
+        case dcf::ValueType::ARRAY:
+            writeArray(value.arrayContents(), depth);
+            break;
+
+        case dcf::ValueType::SECTION:
+            writeSection(value.asSection(), depth);
+            break;
+    }
+}
+
+
+// Writes the header trimmed, with every line after the first indented and turned into a comment
+inline void dcf::internal::Writer::writeHeader(std::string_view header, int depth) {
+    const auto isSpace = [](char c) { return c == ' ' || (c >= '\t' && c <= '\r'); };
+
+    size_t start = 0;
+    size_t end = header.size();
+    while(start < end && isSpace(header[start])) {
+        start++;
+    }
+    while(end > start && isSpace(header[end - 1])) {
+        end--;
+    }
+    header = header.substr(start, end - start);
+
+    start = 0;
+    size_t newline = header.find('\n');
+    while(newline != std::string_view::npos) {
+        buffer.append(header, start, newline - start);
+        buffer += '\n';
+        writeIndent(depth);
+        buffer += "// ";
+        start = newline + 1;
+        while(start < header.size() && (header[start] == ' ' || header[start] == '\t')) {
+            start++;
+        }
+        newline = header.find('\n', start);
+    }
+    if(start < header.size()) {
+        buffer.append(header, start, std::string_view::npos);
+    }
+}
+
+
+// Opens a section or array, the elements go on lines of their own unless minified
+inline void dcf::internal::Writer::open(char bracket) {
+    buffer += bracket;
+    if(!options.minified) {
+        buffer += '\n';
+    }
+}
+
+
+// Depth is the nesting level of the elements, like for writeSection
+inline void dcf::internal::Writer::close(char bracket, int depth) {
+    writeIndent(depth - 1);
+    buffer += bracket;
+}
+
+
+inline void dcf::internal::Writer::writeKey(std::string_view key, int depth) {
+    writeIndent(depth);
+    buffer += key;
+    buffer += options.minified ? ":" : ": ";
+}
+
+
+inline void dcf::internal::Writer::writeSeparator(bool last) {
+    if(options.minified) {
+        if(!last) {
+            buffer += ',';
+        }
+    } else {
+        buffer += last ? "\n" : ",\n";
+    }
+}
+
+
+// Minified text is not indented
+inline void dcf::internal::Writer::writeIndent(int depth) {
+    if(!options.minified) {
+        buffer.append(static_cast<size_t>(options.indent * depth), ' ');
+    }
+}
+
+
+inline void dcf::internal::Writer::flush() {
+    if(out != nullptr && buffer.size() >= FLUSH_SIZE) {
+        out->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+}
+
+
+
+// Text output of sections is defined along with the writer it goes through
+
+inline std::string dcf::Section::toString(int indent) const {
+    WriteOptions options;
+    options.indent = indent;
+    return toString(options);
+}
+
+
+inline std::string dcf::Section::toString(const WriteOptions &options) const {
+    std::string text;
+    write(text, options);
+    return text;
+}
+
+
+inline void dcf::Section::write(std::string &buffer, const WriteOptions &options) const {
+    internal::Writer(buffer, options).write(*this);
+}
+
+
+inline void dcf::Section::write(std::ostream &out, const WriteOptions &options) const {
+    std::string buffer;
+    internal::Writer(buffer, options, &out).write(*this);
+}
+
+#endif // WRITER_HPP
@@ -1,6 +1,22 @@
 #include "dcf.hpp"
+#include <chrono>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 
@@ -19,6 +35,1386 @@ void readFile(const std::string &file, std::string &content) {
 
 
 
+// Behavior checks, each failure is printed and counted
+
+int failures = 0;
+
+
+void check(bool condition, const std::string &name) {
+    if(!condition) {
+        std::cout << "FAILED: " << name << std::endl;
+        failures++;
+    }
+}
+
+
+// Checks that the code throws the given exception type
+template<typename Exception>
+void checkThrows(const std::function<void()> &code, const std::string &name) {
+    try {
+        code();
+    } catch(const Exception&) {
+        return;
+    } catch(const std::exception &e) {
+        check(false, name + " (threw " + e.what() + ")");
+        return;
+    }
+    check(false, name + " (did not throw)");
+}
+
+
+// The message of the parse error the code throws, or nothing
+std::string parseErrorOf(const std::function<void()> &code) {
+    try {
+        code();
+    } catch(const dcf::parse_error &e) {
+        return e.what();
+    }
+    return "";
+}
+
+
+
+// user-009: files are parsed from a mapping, or read if they cannot be mapped
+
+void testParseFile(const std::string &fullFile) {
+    const dcf::Section parsed = dcf::parse(fullFile);
+    check(dcf::parseFile("test/simple.dcf") == parsed, "parseFile matches parse");
+    check(dcf::parseFile("test/simple.dcf").toString() == parsed.toString(), "parseFile keeps headers and order");
+
+    dcf::ParseOptions lazy;
+    lazy.lazy = true;
+    const dcf::Section lazySection = dcf::parseFile("test/simple.dcf", lazy);
+    check(lazySection == parsed, "lazy parseFile keeps the file for its values");
+
+    // Empty files cannot be mapped and are read instead
+    const std::string empty = "dcf-test-empty.dcf";
+    std::ofstream(empty).close();
+    check(parseErrorOf([&] { dcf::parseFile(empty); }) == parseErrorOf([] { dcf::parse(""); })
+        && !parseErrorOf([] { dcf::parse(""); }).empty(), "empty file");
+    std::remove(empty.c_str());
+
+    // Neither can pipes, whose writer may be done before the file is read
+    const std::string pipe = "dcf-test-pipe";
+    std::remove(pipe.c_str());
+    if(::mkfifo(pipe.c_str(), 0600) == 0) {
+        bool same = true;
+        for(int i = 0; i < 20; i++) {
+            std::thread writer([&pipe, &fullFile] {
+                std::ofstream(pipe) << fullFile;
+            });
+            same = same && dcf::parseFile(pipe) == parsed;
+            writer.join();
+        }
+        check(same, "parseFile reads pipes");
+        std::remove(pipe.c_str());
+    } else {
+        check(false, "creating a pipe");
+    }
+
+    checkThrows<std::runtime_error>([] { dcf::parseFile("test/missing.dcf"); }, "missing file");
+}
+
+
+
+// A document with every kind of value, for the checks below
+const std::string DOCUMENT = R"({
+    // header of the name
+    name: "dcf",
+    version: 3,
+    ratio: 0.25,
+    whole: 2.0,
+    negative: -1.5e-3,
+    hex: 0x1F,
+    binary: -0b101,
+    enabled: true,
+    /* a block
+       comment */
+    ints: [1, 2, 3, -4],
+    doubles: [0.5, 1.5, 2.5],
+    bools: [true, false],
+    mixed: [1, "two", 3.5, [4], {five: 5}],
+    empty: [],
+    server: {
+        host: 'localhost',
+        ports: [80, 443],
+        limits: { connections: 100, timeout: 2.5 },
+        tags: ["a", "b"]
+    },
+    list: [
+        { id: 1, ok: true },
+        { id: 2, ok: false }
+    ],
+    nothing: {}
+})";
+
+
+
+// user-001, user-002: the lexer gives the tokens the regular expressions of the original
+// lexer gave, at the same positions
+
+struct ReferenceToken {
+    dcf::internal::Token::Type type;
+    std::string value;
+    size_t line;
+    size_t column;
+};
+
+
+// The token table of the original lexer, tried in order at every position. Input it has
+// no token for ends in an END_OF_INPUT token at that position.
+std::vector<ReferenceToken> referenceTokens(const std::string &text) {
+    using Type = dcf::internal::Token::Type;
+    static const std::pair<const char*, Type> definitions[] = {
+        {R"(\s+)",                                                      Type::WHITESPACE},
+        {R"(//[^\n]*|/\*(?:.|\n)*?\*/)",                                Type::COMMENT},
+        {R"("[^"\n]*"|'[^'\n]*')",                                      Type::STRING},
+        {R"(true|false)",                                               Type::BOOLEAN},
+        {R"(-?(?:\d+\.\d*|\.\d+)(?:[eE][+-]?\d+)?|-?\d+[eE][+-]?\d+)",  Type::NUM_DECIMAL},
+        {R"(-?0x[\da-fA-F]+)",                                          Type::NUM_HEX},
+        {R"(-?0b[01]+)",                                                Type::NUM_BINARY},
+        {R"(-?\d+)",                                                    Type::NUM_INT},
+        {R"([a-zA-Z](?:[\w-]*[a-zA-Z0-9])?)",                           Type::KEY},
+        {R"(@[a-zA-Z]+)",                                               Type::FUNCTION},
+        {R"(\()",                                                       Type::L_PAREN},
+        {R"(\))",                                                       Type::R_PAREN},
+        {R"(\{)",                                                       Type::L_BRACE},
+        {R"(})",                                                        Type::R_BRACE},
+        {R"(\[)",                                                       Type::L_BRACKET},
+        {R"(])",                                                        Type::R_BRACKET},
+        {R"(:)",                                                        Type::COLON},
+        {R"(,)",                                                        Type::COMMA}
+    };
+
+    std::vector<ReferenceToken> tokens;
+    size_t line = 1, column = 1, pos = 0;
+    while(pos < text.size()) {
+        const std::string rest = text.substr(pos);
+        bool matched = false;
+        for(const auto &[pattern, type] : definitions) {
+            std::smatch match;
+            if(!std::regex_search(rest, match, std::regex(std::string("^(?:") + pattern + ")"))) {
+                continue;
+            }
+            const std::string value = match.str(0);
+            if(type != Type::WHITESPACE) {
+                tokens.push_back({type, value, line, column});
+            }
+            for(char c : value) {
+                if(c == '\n') {
+                    line++;
+                    column = 1;
+                } else {
+                    column++;
+                }
+            }
+            pos += value.size();
+            matched = true;
+            break;
+        }
+        if(!matched) {
+            tokens.push_back({Type::END_OF_INPUT, "", line, column});
+            break;
+        }
+    }
+    return tokens;
+}
+
+
+std::vector<ReferenceToken> lexerTokens(const std::string &text) {
+    using Type = dcf::internal::Token::Type;
+    std::vector<ReferenceToken> tokens;
+    try {
+        dcf::internal::Lexer lexer(text);
+        for(dcf::internal::Token token = lexer.next(); token.type != Type::END_OF_INPUT; token = lexer.next()) {
+            tokens.push_back({token.type, std::string(token.value), token.line, token.column});
+        }
+    } catch(const dcf::parse_error &e) {
+        tokens.push_back({Type::END_OF_INPUT, "", e.line(), e.column()});
+    }
+    return tokens;
+}
+
+
+void checkTokens(const std::string &input) {
+    const std::vector<ReferenceToken> expected = referenceTokens(input);
+    const std::vector<ReferenceToken> actual = lexerTokens(input);
+    bool same = expected.size() == actual.size();
+    for(size_t i = 0; same && i < expected.size(); i++) {
+        same = expected[i].type == actual[i].type && expected[i].value == actual[i].value
+            && expected[i].line == actual[i].line && expected[i].column == actual[i].column;
+    }
+    check(same, "lexer matches the original lexer on " + input.substr(0, 40));
+}
+
+
+void testLexer(const std::string &fullFile) {
+    std::string testFile;
+    readFile("test/test.dcf", testFile);
+
+    for(const std::string &input : {DOCUMENT, fullFile, testFile,
+        std::string("{a:1,b:-2.,c:.5,d:1e5,e:-1E-5,f:0x,g:0b2,h:truex,i:key-name-2}"),
+        std::string("{s: \"it's\", t: 'say \"hi\"', u: \"\", v: ''}"),
+        std::string("// only a comment"),
+        std::string("/* unterminated"),
+        std::string("{a: \"unterminated\n}"),
+        std::string("{a: #}"),
+        std::string("{a: @concat(1, @this(\"b\"))}\r\n\t{ }"),
+        std::string("{a: 1} // trailing\n/* multi\nline */ {b: 2}")}) {
+        checkTokens(input);
+    }
+}
+
+
+
+// user-003: tokens peeked far ahead are taken in order, however many comments come first
+
+void testLookahead() {
+    std::string text = "{";
+    for(int i = 0; i < 100; i++) {
+        text += " /* comment " + std::to_string(i) + " */ // line\n";
+    }
+    text += "a: [1, /* inner */ 2], // after\n b: 'x' }";
+
+    const std::vector<ReferenceToken> expected = lexerTokens(text);
+    dcf::internal::Lexer lexer(text);
+    bool same = lexer.peek(expected.size() - 1).value == expected.back().value;
+    for(size_t i = 0; same && i < expected.size(); i++) {
+        const std::string peeked(lexer.peek(expected.size() - 1 - i).value);
+        same = peeked == expected.back().value && lexer.next().value == expected[i].value;
+    }
+    check(same, "peeking ahead past many comments");
+
+    check(dcf::parse(text) == dcf::parse("{a: [1, 2], b: 'x'}"), "parsing past many comments");
+}
+
+
+
+// user-004: the bulk scans find the same positions as the plain loops, with runs longer
+// than a block and matches right at the edges of blocks
+
+void testScanning() {
+    namespace simd = dcf::internal::simd;
+
+    bool whitespace = true, either = true, newlines = true;
+    for(size_t length = 0; length < 100; length++) {
+        for(size_t start = 0; start < 3; start++) {
+            const std::string spaces = std::string(start, 'x') + std::string(length, length % 3 == 0 ? '\t' : ' ') + "x" + std::string(40, ' ');
+            whitespace = whitespace && simd::findNonWhitespace(spaces, start) == start + length;
+
+            const std::string text = std::string(start + length, 'a') + "*" + std::string(length, '\n') + "\r";
+            either = either && simd::findEither(text, start, '*', '\r') == start + length
+                && simd::findEither(text, start + length + 1, '\r', '?') == start + 2 * length + 1
+                && simd::findEither(text, start, '?', '!') == std::string_view::npos;
+
+            const simd::NewlineCount count = simd::countNewlines(text, start, text.size());
+            newlines = newlines && count.count == length && (length == 0 ? count.last == std::string_view::npos : count.last == start + 2 * length);
+        }
+    }
+    check(whitespace, "finding the end of whitespace");
+    check(either, "finding either of two characters");
+    check(newlines, "counting newlines");
+
+    // Whitespace and comments around block edges lex like the original lexer did
+    for(size_t length = 1; length < 70; length += 3) {
+        const std::string pad(length, ' ');
+        checkTokens("{" + pad + "a:" + pad + "1," + pad + "// " + pad + "x\n" + pad + "b: 'y" + pad + "'," + pad + "/*" + pad + "*/" + pad + "c: 2}");
+    }
+}
+
+
+
+// user-005: documents parse into their arena, copies out of it don't refer to it, and the
+// accessors keep the types they always had
+
+static_assert(std::is_same_v<decltype(std::declval<dcf::Value>().asString()), const std::string&>, "asString gives a std::string");
+static_assert(std::is_convertible_v<decltype(std::declval<dcf::Value>().asArray()), const std::vector<dcf::Value>&>, "asArray gives a std::vector");
+static_assert(std::is_convertible_v<const std::string&, dcf::Value>, "strings convert to values");
+
+void testDocument() {
+    const dcf::Section plain = dcf::parse(DOCUMENT);
+    const std::string text = plain.toString();
+
+    dcf::ParseOptions lazy;
+    lazy.lazy = true;
+    for(const dcf::ParseOptions &options : {dcf::ParseOptions(), lazy}) {
+        dcf::Section copy;
+        std::optional<dcf::Value> server;
+        std::vector<dcf::Value> list;
+        {
+            dcf::Document document(DOCUMENT, options);
+            check(document.root() == plain && document.root().toString() == text, "document matches parse");
+            copy = document.root();
+            server.emplace(document.root().get("server"));
+            list = document.root().get("list").asArray();
+        }
+        // The arena is gone, so all of these have to be deep copies
+        check(copy == plain && copy.toString() == text, "copy of a document outlives it");
+        check(server->asSection() == plain.get("server").asSection(), "value copied out of a document outlives it");
+        check(list.size() == 2 && list[1].asSection().get("id").asInt() == 2, "array copied out of a document outlives it");
+    }
+
+    const std::string longText(100, 'x');
+    dcf::Document document("{s: \"" + longText + "\", a: [1, \"two\"], b: [1, 2]}");
+    const std::string &string = document.root().get("s").asString();
+    const std::vector<dcf::Value> &array = document.root().get("a").asArray();
+    check(string == longText && array.size() == 2 && array[1].asString() == "two", "accessors bind to const references");
+    const dcf::ArrayView<dcf::Value> view = document.root().get("a").asValueArray();
+    check(view.size() == 2 && &view[1] == &document.root().get("a").asValueArray()[1], "arrays viewed in place");
+    checkThrows<std::runtime_error>([&] { document.root().get("b").asValueArray(); }, "packed array has no value view");
+
+    // Copies into an arena and back out of it
+    std::optional<dcf::Section> outOfArena;
+    {
+        std::pmr::monotonic_buffer_resource arena;
+        const dcf::Section inArena(plain, &arena);
+        check(inArena == plain, "copy into an arena");
+        outOfArena.emplace(inArena);
+    }
+    check(*outOfArena == plain, "copy out of an arena outlives it");
+}
+
+
+
+// user-006: values and sections are moved rather than copied, and read by reference
+
+static_assert(std::is_nothrow_move_constructible_v<dcf::Value> && std::is_nothrow_move_constructible_v<dcf::Section>, "moves don't throw");
+static_assert(std::is_same_v<decltype(std::declval<dcf::Section>().get("")), const dcf::Value&>, "get gives a reference");
+
+void testMoves() {
+    dcf::Section section = dcf::parse(DOCUMENT);
+    const dcf::Section original = section;
+
+    const dcf::Value *server = &section.get("server");
+    check(server == &section.get("server") && server == section.find("server"), "get and find give the stored value");
+    check(section.find("missing") == nullptr && !section.optionalGet("missing"), "find and optionalGet of a missing key");
+
+    dcf::Section moved = std::move(section);
+    check(moved == original && moved.get("server").asSection().get("ports").asArray().size() == 2, "moved section");
+
+    dcf::Value value = moved.get("list");
+    dcf::Value movedValue = std::move(value);
+    check(movedValue == original.get("list"), "moved value");
+
+    dcf::Section target;
+    target.set("list", std::move(movedValue));
+    target.set("server", dcf::Section(moved.get("server").asSection()));
+    target.set("array", std::vector<dcf::Value>{int64_t(1), std::string("two")});
+    check(target.get("list") == original.get("list") && target.get("server") == original.get("server"), "setting moved values");
+    check(target.get("array").asArray()[1].asString() == "two", "setting a moved array");
+
+    // Copies stay independent of what they were copied from
+    dcf::Section copy = moved;
+    moved.set("name", std::string("changed"));
+    check(copy.get("name").asString() == "dcf" && moved.get("name").asString() == "changed", "copies are independent");
+}
+
+
+
+// user-007: sections keep their insertion order through removals, small ones and large
+// ones with an index alike
+
+void testSectionStorage() {
+    for(int64_t size : {5, 100}) {
+        dcf::Section section;
+        for(int64_t i = 0; i < size; i++) {
+            section.set("k" + std::to_string(i), i);
+        }
+        for(int64_t i = 0; i < size; i += 2) {
+            section.remove("k" + std::to_string(i));
+        }
+        section.set("k1", int64_t(-1));
+        section.set("k0", int64_t(0));
+
+        std::vector<std::string> expected;
+        for(int64_t i = 1; i < size; i += 2) {
+            expected.push_back("k" + std::to_string(i));
+        }
+        expected.push_back("k0");
+
+        bool found = section.get("k1").asInt() == -1;
+        for(int64_t i = 2; i < size; i++) {
+            const dcf::Value *value = section.find("k" + std::to_string(i));
+            found = found && (i % 2 == 0 ? value == nullptr : value != nullptr && value->asInt() == i);
+        }
+        check(found, "lookups after removals, " + std::to_string(size) + " keys");
+        check(section.keys() == expected, "order after removals, " + std::to_string(size) + " keys");
+        checkThrows<std::runtime_error>([&] { section.remove("k2"); }, "removing a missing key");
+    }
+
+    // Removing most of a large section compacts it without losing the order
+    dcf::Section section;
+    for(int64_t i = 0; i < 1000; i++) {
+        section.set("k" + std::to_string(i), i);
+    }
+    for(int64_t i = 0; i < 999; i++) {
+        section.remove("k" + std::to_string(i));
+    }
+    section.set("a", true);
+    check(section.keys() == std::vector<std::string>{"k999", "a"} && section.get("k999").asInt() == 999, "compacted section");
+    check(dcf::parse(section.toString()) == section, "compacted section written and read");
+}
+
+
+
+// user-008: keys are looked up by string_view and by precomputed handles, which stay
+// right when the section changes or they are used on another one
+
+void testKeys() {
+    dcf::Section section = dcf::parse(DOCUMENT);
+    const std::string name = "version";
+    check(section.get(std::string_view(name)).asInt() == 3 && section.get(name.c_str()).asInt() == 3, "lookup by string_view");
+
+    const dcf::Key version("version");
+    const dcf::Key missing("missing");
+    check(version.name() == "version", "key name");
+    check(section.get(version).asInt() == 3 && section.find(missing) == nullptr && !section.optionalGet(missing), "lookup by key handle");
+
+    // Moving the entry or using the handle on other sections does not mislead it
+    section.remove("name");
+    section.set("version", int64_t(4));
+    const dcf::Section other = dcf::parse("{a: 1, b: 2, version: 5}");
+    check(section.get(version).asInt() == 4 && other.get(version).asInt() == 5 && section.get(version).asInt() == 4, "key handle on changed and other sections");
+    section.remove("version");
+    check(section.find(version) == nullptr, "key handle of a removed key");
+
+    dcf::Section large;
+    for(int64_t i = 0; i < 100; i++) {
+        large.set("k" + std::to_string(i), i);
+    }
+    const dcf::Key key("k50");
+    const dcf::Key copy = key;
+    check(large.get(key).asInt() == 50 && large.get(copy).asInt() == 50, "key handle on a large section");
+    checkThrows<std::runtime_error>([&] { large.get(missing); }, "missing key handle throws");
+}
+
+
+
+// user-010: lazy parses give what eager ones give, with errors at the same positions once
+// the broken value is accessed
+
+// Line and column of the parse error the code throws, zeros if none
+std::pair<size_t, size_t> errorPosition(const std::function<void()> &code) {
+    try {
+        code();
+    } catch(const dcf::parse_error &e) {
+        return {e.line(), e.column()};
+    }
+    return {0, 0};
+}
+
+
+void testLazyParsing(const std::string &fullFile) {
+    dcf::ParseOptions lazy;
+    lazy.lazy = true;
+    for(const std::string &text : {DOCUMENT, fullFile}) {
+        const dcf::Section eager = dcf::parse(text);
+        const dcf::Section deferred = dcf::parse(text, lazy);
+        check(deferred == eager && deferred.toString() == eager.toString(), "lazy parse matches on " + text.substr(0, 20));
+    }
+
+    // Deferred values are parsed once, whichever thread gets to them first
+    std::string large = "{\n";
+    for(int i = 0; i < 200; i++) {
+        large += "    key" + std::to_string(i) + ": { n: " + std::to_string(i) + ", list: [1, 2.5, \"x\"], text: \"a long enough value\" },\n";
+    }
+    large += "}";
+    const dcf::Section deferred = dcf::parse(large, lazy);
+    std::vector<std::thread> threads;
+    std::vector<int64_t> sums(4, 0);
+    for(size_t t = 0; t < sums.size(); t++) {
+        threads.emplace_back([&deferred, &sums, t] {
+            for(int i = 0; i < 200; i++) {
+                sums[t] += deferred.get("key" + std::to_string(i)).asSection().get("n").asInt();
+            }
+        });
+    }
+    for(std::thread &thread : threads) {
+        thread.join();
+    }
+    check(sums == std::vector<int64_t>(4, 199 * 200 / 2) && deferred == dcf::parse(large), "lazy values read from several threads");
+
+    // A syntax error deep inside is reported at its position once it is reached, and
+    // text whose brackets don't match is parsed eagerly
+    const std::string padding(80, ' ');
+    const std::string broken = "{a: 1, b: {c: [1, 2,, 3]," + padding + "d: 1}}";
+    const std::pair<size_t, size_t> position = errorPosition([&] { dcf::parse(broken); });
+    check(position == std::make_pair(size_t(1), size_t(21)), "syntax error position");
+    const dcf::Section brokenLazily = dcf::parse(broken, lazy);
+    check(brokenLazily.get("a").asInt() == 1, "lazy parse up to the broken value");
+    check(errorPosition([&] { brokenLazily.get("b").asSection().get("c").asArray(); }) == position, "lazy syntax error position");
+    const std::string unmatched = "{a: {b: [1, 2}, c: 3}";
+    check(errorPosition([&] { dcf::parse(unmatched, lazy); }) == errorPosition([&] { dcf::parse(unmatched); }), "unmatched brackets");
+
+    // The depth limit holds for deferred values too
+    const std::string deep = "{a: " + std::string(40, '[') + std::string(40, ']') + "}";
+    dcf::ParseOptions shallow = lazy;
+    shallow.maxDepth = 30;
+    const dcf::Section deepSection = dcf::parse(deep, shallow);
+    checkThrows<dcf::parse_error>([&] {
+        std::vector<dcf::Value> array = deepSection.get("a").asArray();
+        while(!array.empty()) {
+            array = array[0].asArray();
+        }
+    }, "depth limit of lazy values");
+}
+
+
+
+// user-011: large documents parse on several threads to what one thread gives, with
+// duplicate keys, calls between pairs and errors handled as they are sequentially
+
+void testThreadedParsing() {
+    dcf::ParseOptions threaded;
+    threaded.threads = 4;
+    dcf::ParseOptions allThreads;
+    allThreads.threads = 0;
+
+    std::string large = "{\n";
+    for(int i = 0; i < 4000; i++) {
+        large += "    // header " + std::to_string(i) + "\n";
+        large += "    key" + std::to_string(i % 3000) + ": { n: " + std::to_string(i) + ", list: [1, 2.5, \"x, y\"], text: 'a, b' },\n";
+    }
+    large += "    last: @this(\"key7.n\"),\n    sum: @concat(\"a\", \"b\")\n}";
+
+    const dcf::Section sequential = dcf::parse(large);
+    for(const dcf::ParseOptions &options : {threaded, allThreads}) {
+        const dcf::Section parallel = dcf::parse(large, options);
+        check(parallel == sequential && parallel.toString() == sequential.toString(), "threaded parse matches");
+        check(parallel.get("key7").asSection().get("n").asInt() == 3007 && parallel.get("last").asInt() == 3007, "threaded parse with duplicate keys and calls");
+    }
+
+    const std::string broken = large.substr(0, large.size() - 60) + "x: [1,, 2],\n" + large.substr(large.size() - 60);
+    check(parseErrorOf([&] { dcf::parse(broken, threaded); }) == parseErrorOf([&] { dcf::parse(broken); })
+        && !parseErrorOf([&] { dcf::parse(broken); }).empty(), "threaded syntax error");
+}
+
+
+
+// user-012: long lists parse without deep recursion, and nesting is limited to maxDepth
+// with the root section at depth one
+
+void testNesting() {
+    std::string longList = "{a: [";
+    for(int i = 0; i < 300000; i++) {
+        longList += "{b: " + std::to_string(i) + "}, ";
+    }
+    longList += "0]}";
+    const dcf::Section list = dcf::parse(longList);
+    check(list.get("a").asArray().size() == 300001 && list.get("a").asArray()[299999].asSection().get("b").asInt() == 299999, "long list");
+
+    for(size_t depth : {size_t(5), size_t(1024)}) {
+        // Arrays, sections and calls nested depth levels deep, counting the root
+        std::string arrays = "{a: " + std::string(depth - 1, '[') + std::string(depth - 1, ']') + "}";
+        std::string sections = "{";
+        for(size_t i = 1; i < depth; i++) {
+            sections += "a: {";
+        }
+        sections += std::string(depth, '}');
+        std::string calls = "{a: ";
+        for(size_t i = 1; i < depth; i++) {
+            calls += "@concat(";
+        }
+        calls += "'x'" + std::string(depth - 1, ')') + "}";
+
+        dcf::ParseOptions limit;
+        limit.maxDepth = depth;
+        dcf::ParseOptions tooShallow;
+        tooShallow.maxDepth = depth - 1;
+        for(const std::string &text : {arrays, sections, calls}) {
+            check(parseErrorOf([&] { dcf::parse(text, limit); }).empty(), "nesting up to the limit on " + text.substr(0, 12));
+            check(!parseErrorOf([&] { dcf::parse(text, tooShallow); }).empty(), "nesting beyond the limit on " + text.substr(0, 12));
+        }
+        check(parseErrorOf([&] { dcf::parse(arrays); }).empty(), "nesting within the default limit");
+    }
+    check(!parseErrorOf([] { dcf::parse("{a: " + std::string(1100, '[') + std::string(1100, ']') + "}"); }).empty(), "nesting beyond the default limit");
+}
+
+
+
+// user-013: numbers convert exactly, and ones that don't fit are parse errors at their
+// position
+
+void testNumbers() {
+    const dcf::Section numbers = dcf::parse(R"({
+        max: 9223372036854775807, min: -9223372036854775808, zero: -0,
+        hex: 0xFFFFFFFFFFFFFFFF, negativeHex: -0x10, binary: 0b1000000000000000000000000000000000000000000000000000000000000000,
+        tenth: 0.1, exponent: -2.5E+3, small: 4.9e-324, leading: .5, trailing: 5.
+    })");
+    check(numbers.get("max").asInt() == std::numeric_limits<int64_t>::max() && numbers.get("min").asInt() == std::numeric_limits<int64_t>::min(), "integer limits");
+    check(numbers.get("zero").asInt() == 0, "negative zero");
+    check(numbers.get("hex").asInt() == -1 && numbers.get("negativeHex").asInt() == -16, "hexadecimal bit patterns");
+    check(numbers.get("binary").asInt() == std::numeric_limits<int64_t>::min(), "binary bit pattern");
+    check(numbers.get("tenth").asDouble() == 0.1 && numbers.get("exponent").asDouble() == -2500.0, "decimals");
+    check(numbers.get("small").asDouble() == 4.9e-324 && numbers.get("leading").asDouble() == 0.5 && numbers.get("trailing").asDouble() == 5.0, "subnormal and short decimals");
+
+    for(const std::string &number : {std::string("9223372036854775808"), std::string("-9223372036854775809"),
+        std::string("0x1FFFFFFFFFFFFFFFF"), std::string("0b") + std::string(65, '1'), std::string("1e400")}) {
+        const std::string text = "{\n  a: 1,\n  b: " + number + "\n}";
+        check(parseErrorOf([&] { dcf::parse(text); }).find("Number out of range") != std::string::npos, "out of range: " + number);
+        check(errorPosition([&] { dcf::parse(text); }) == std::make_pair(size_t(3), size_t(6)), "position of out of range: " + number);
+    }
+}
+
+
+
+// user-014: the writer gives the text the original toString gave, and writes it minified,
+// appended to a buffer or to a stream
+
+void testWriter() {
+    dcf::Section section = dcf::parse(R"({
+    // header
+    name: "dcf",
+    ratio: 0.1,
+    third: 0.333333333333333333,
+    large: 1e20,
+    whole: 2.0,
+    list: [1, [], {}, [true, 'x'], { a: -1 }],
+    /* block */
+    nested: { empty: {}, b: { c: 1.5 } }
+})");
+    section.remove("ratio");
+
+    // As written by the original toString
+    const std::string expected = R"({
+    // header
+    name: "dcf",
+    third: 0.333333333333333,
+    large: 1e+20,
+    whole: 2,
+    list: [
+        1,
+        [],
+        {},
+        [
+            true,
+            "x"
+        ],
+        {
+            a: -1
+        }
+    ],
+
+    // block
+    nested: {
+        empty: {},
+        b: {
+            c: 1.5
+        }
+    }
+})";
+    check(section.toString() == expected, "text as written before");
+    check(section.toString(2) == std::regex_replace(expected, std::regex("    "), "  ") && section.toString(0) == std::regex_replace(expected, std::regex("\n +"), "\n"), "indents as written before");
+    checkThrows<std::range_error>([&] { section.toString(-1); }, "negative indent");
+
+    dcf::WriteOptions minified;
+    minified.minified = true;
+    const std::string minifiedText = section.toString(minified);
+    check(minifiedText == "{name:\"dcf\",third:0.333333333333333,large:1e+20,whole:2,list:[1,[],{},[true,\"x\"],{a:-1}],nested:{empty:{},b:{c:1.5}}}", "minified text");
+    check(dcf::parse(minifiedText).toString(minified) == minifiedText, "minified text reads back");
+
+    std::string buffer = "prefix";
+    section.write(buffer);
+    check(buffer == "prefix" + expected, "writing appends to a buffer");
+
+    // Larger than the blocks handed to the stream
+    dcf::Section large;
+    for(int64_t i = 0; i < 20000; i++) {
+        large.set("key" + std::to_string(i), std::vector<dcf::Value>{i, 0.5, std::string("text")});
+    }
+    std::ostringstream stream;
+    large.write(stream);
+    check(stream.str() == large.toString(), "writing to a stream");
+}
+
+
+
+// user-015: binary data reads back to the section it was written from, in place or from
+// a file, and corrupt data is rejected without reading out of bounds
+
+void testBinary() {
+    const dcf::Section section = dcf::parse(DOCUMENT);
+    const std::string data = dcf::toBinary(section);
+    const dcf::BinaryDocument document = dcf::loadBinary(data);
+    const dcf::BinarySection root = document.root();
+
+    check(root.toSection() == section && root.toSection().toString() == section.toString(), "binary round trip keeps order and headers");
+    check(root.get("name").asString() == "dcf" && root.get("ratio").asDouble() == 0.25 && root.get("enabled").asBool(), "binary values read in place");
+    check(root.get("server").asSection().get("ports").asArray()[1].asInt() == 443, "nested binary values read in place");
+    check(!root.find("missing").has_value() && root.getHeader("name") == "\n header of the name", "binary lookup");
+    check(root.keys() == section.keys(), "binary keys in order");
+    checkThrows<std::runtime_error>([&] { root.get("name").asInt(); }, "binary type mismatch");
+
+    const std::string path = "dcf-test-binary.dcfb";
+    std::ofstream(path, std::ios::binary) << data;
+    check(dcf::loadBinaryFile(path).root().toSection() == section, "binary file round trip");
+    std::remove(path.c_str());
+
+    // Sections large enough for a hash index
+    dcf::Section large;
+    for(int64_t i = 0; i < 1000; i++) {
+        large.set("key" + std::to_string(i), i);
+    }
+    const dcf::BinaryDocument largeDocument = dcf::loadBinary(dcf::toBinary(large));
+    bool found = true;
+    for(int64_t i = 0; i < 1000; i++) {
+        found = found && largeDocument.root().get("key" + std::to_string(i)).asInt() == i;
+    }
+    check(found && !largeDocument.root().find("key1000").has_value(), "lookup in a large binary section");
+
+    checkThrows<std::runtime_error>([&] { dcf::loadBinary(data.substr(0, 8)); }, "truncated binary data");
+    checkThrows<std::runtime_error>([&] { dcf::loadBinary("not binary dcf data at all, not at all"); }, "binary data without magic");
+    std::mt19937 random(1);
+    for(int i = 0; i < 2000; i++) {
+        std::string corrupt = data;
+        for(int j = 0; j < 4; j++) {
+            corrupt[random() % corrupt.size()] = static_cast<char>(random());
+        }
+        try {
+            (void) dcf::loadBinary(corrupt).root().toSection().toString();
+        } catch(const std::runtime_error&) {
+            // Most of them are found out
+        }
+    }
+
+    // Arrays nested too deep to copy out are rejected as well
+    dcf::Value nested(std::vector<dcf::Value>{});
+    for(int i = 0; i < 2000; i++) {
+        nested = dcf::Value(std::vector<dcf::Value>{nested});
+    }
+    dcf::Section deep;
+    deep.set("deep", std::move(nested));
+    const std::string deepData = dcf::toBinary(deep);
+    checkThrows<std::runtime_error>([&] { dcf::loadBinary(deepData).root().toSection(); }, "binary arrays nested too deep");
+}
+
+
+
+// user-016: handlers get every part of a document in order, and the errors parsing it
+// into sections gives
+
+struct RecordingHandler : dcf::Handler {
+    std::vector<std::string> events;
+
+    void beginSection() override { events.push_back("{"); }
+    void endSection() override { events.push_back("}"); }
+    void header(std::string_view comment) override { events.push_back("header " + std::string(comment)); }
+    void key(std::string_view key) override { events.push_back("key " + std::string(key)); }
+    void stringValue(std::string_view value) override { events.push_back("string " + std::string(value)); }
+    void boolValue(bool value) override { events.push_back(value ? "true" : "false"); }
+    void intValue(int64_t value) override { events.push_back("int " + std::to_string(value)); }
+    void doubleValue(double value) override { events.push_back("double " + std::to_string(value)); }
+    void beginArray() override { events.push_back("["); }
+    void endArray() override { events.push_back("]"); }
+    void beginFunction(std::string_view name) override { events.push_back("@" + std::string(name)); }
+    void endFunction() override { events.push_back(")"); }
+};
+
+
+void testHandler(const std::string &fullFile) {
+    RecordingHandler handler;
+    dcf::parse("{\n // first\n /* second */\n a: 'x', b: [1, 2.5, true, {}], c: @concat(\"y\", 0x10)\n}", handler);
+    const std::vector<std::string> expected = {"{", "header  first", "header  second ", "key a", "string x",
+        "key b", "[", "int 1", "double 2.500000", "true", "{", "}", "]", "key c", "@concat", "string y", "int 16", ")", "}"};
+    check(handler.events == expected, "handler events in order");
+
+    RecordingHandler fromText, fromFile;
+    dcf::parse(fullFile, fromText);
+    dcf::parseFile("test/simple.dcf", fromFile);
+    check(!fromText.events.empty() && fromFile.events == fromText.events, "handler events from a file");
+
+    const std::string broken = "{a: [1, 2}";
+    RecordingHandler brokenHandler;
+    check(parseErrorOf([&] { dcf::parse(broken, brokenHandler); }) == parseErrorOf([&] { dcf::parse(broken); }), "handler syntax error");
+    dcf::ParseOptions shallow;
+    shallow.maxDepth = 2;
+    RecordingHandler deepHandler;
+    check(!parseErrorOf([&] { dcf::parse("{a: [[1]]}", deepHandler, shallow); }).empty(), "handler depth limit");
+}
+
+
+
+// user-017: structs bound with DCF_BIND are read and written like the sections they stand for
+
+struct Limits {
+    int connections = 0;
+    double timeout = 0;
+};
+DCF_BIND(Limits, connections, timeout)
+
+struct Server {
+    std::string host;
+    std::vector<uint16_t> ports;
+    Limits limits;
+    std::optional<std::string> user;
+    std::vector<std::string> tags;
+};
+DCF_BIND(Server, host, ports, limits, user, tags)
+
+struct Unbound {
+    int value = 0;
+};
+
+// dcf::toString only takes bound structs, so it can be detected like any other overload
+template<typename T, typename = void>
+struct Writable : std::false_type { };
+template<typename T>
+struct Writable<T, std::void_t<decltype(dcf::toString(std::declval<const T&>()))>> : std::true_type { };
+
+static_assert(Writable<Server>::value && !Writable<Unbound>::value, "dcf::toString takes bound structs only");
+
+
+void testBinding() {
+    const dcf::Section section = dcf::parse(DOCUMENT);
+    const std::string serverText = section.get("server").asSection().toString();
+
+    const Server server = dcf::parseAs<Server>(serverText);
+    check(server.host == "localhost" && server.ports == std::vector<uint16_t>{80, 443}, "bound members read");
+    check(server.limits.connections == 100 && server.limits.timeout == 2.5, "bound nested struct read");
+    check(!server.user.has_value() && server.tags.size() == 2, "missing optional stays empty");
+    check(dcf::toString(server) == serverText, "bound struct written like its section");
+    check(dcf::parse(dcf::toString(server)) == section.get("server").asSection(), "bound struct round trip");
+
+    dcf::WriteOptions minified;
+    minified.minified = true;
+    Server withUser = server;
+    withUser.user = "admin";
+    check(dcf::toString(withUser, minified) == dcf::parse(dcf::toString(withUser)).toString(minified), "bound writer uses the section layout");
+    check(dcf::parseAs<Server>(dcf::toString(withUser)).user == std::optional<std::string>("admin"), "optional round trip");
+
+    check(dcf::parseAs<Limits>("{timeout: 3, unknown: {a: [1, @concat(\"x\")]}, connections: 5}").timeout == 3.0,
+        "integers read into doubles and unknown keys skipped");
+    checkThrows<dcf::parse_error>([] { dcf::parseAs<Server>("{ports: [70000]}"); }, "integer out of range");
+    checkThrows<dcf::parse_error>([] { dcf::parseAs<Server>("{host: 5}"); }, "wrong type");
+    checkThrows<dcf::parse_error>([] { dcf::parseAs<Server>("{host: 'x', ports: [1,, 2]}"); }, "syntax error in a bound struct");
+    checkThrows<dcf::parse_error>([] { dcf::parseAs<Limits>("{connections: @this(\"timeout\")}"); }, "function call in a bound member");
+}
+
+
+
+// user-018: function calls are evaluated once each, in the order their dependencies need,
+// and cycles are reported as errors
+
+void testFunctions() {
+    const std::string text = "{a: [1, 2, 3], b: @this(\"a.1\"), c: @concat(\"x\", @this(\"b\"), 1.5, true), d: @this(\"e.f\"), e: {f: @this(\"b\")}, g: @this(\"e\")}";
+    dcf::ParseOptions lazy;
+    lazy.lazy = true;
+    for(const dcf::ParseOptions &options : {dcf::ParseOptions(), lazy}) {
+        const dcf::Section section = dcf::parse(text, options);
+        check(section.get("b").asInt() == 2, "@this of an array element");
+        check(section.get("c").asString() == "x21.5true", "@concat");
+        check(section.get("d").asInt() == 2 && section.get("g").asSection().get("f").asInt() == 2, "calls evaluated in dependency order");
+    }
+
+    // Each call runs once, however many others refer to it
+    int calls = 0;
+    dcf::FunctionRegistry functions;
+    functions.add("twice", [&calls](const std::pmr::vector<dcf::Value> &arguments) {
+        calls++;
+        return dcf::Value(arguments.at(0).asInt() * 2);
+    });
+    dcf::ParseOptions options;
+    options.functions = &functions;
+    const dcf::Section section = dcf::parse("{a: @twice(@twice(3)), b: @this(\"a\"), c: [@this(\"a\"), @this(\"b\")]}", options);
+    check(section.get("a").asInt() == 12 && section.get("c").asArray()[1].asInt() == 12, "registered function");
+    check(calls == 2, "calls run once");
+
+    functions.add("fail", [](const std::pmr::vector<dcf::Value>&) -> dcf::Value {
+        throw std::runtime_error("failed");
+    });
+    check(errorPosition([&] { dcf::parse("{a: 1,\n b: @fail()}", options); }) == std::make_pair(size_t(2), size_t(5)), "error of a function at its call");
+
+    checkThrows<dcf::parse_error>([] { dcf::parse("{a: @this(\"b\"), b: @this(\"a\")}"); }, "cycle of calls");
+    checkThrows<dcf::parse_error>([] { dcf::parse("{a: @this(\"a\")}"); }, "call referring to itself");
+    checkThrows<dcf::parse_error>([] { dcf::parse("{a: @this(\"b.c\"), b: {c: [@this(\"a\")]}}"); }, "cycle through nested values");
+    checkThrows<dcf::parse_error>([] { dcf::parse("{a: @missing(1)}"); }, "unknown function");
+    checkThrows<dcf::parse_error>([] { dcf::parse("{a: @this(\"nowhere\")}"); }, "@this to a missing key");
+}
+
+
+
+// user-019: live configs publish a new snapshot for every reload that succeeds and keep
+// the last one when the file is broken. The watcher may reload on its own while these
+// run, so they check the contents of the snapshots rather than exact versions.
+
+// Writes the file in place, or by replacing it the way many editors save
+void writeConfig(const std::string &path, const std::string &text, bool replace = false) {
+    if(!replace) {
+        std::ofstream(path) << text;
+        return;
+    }
+    std::ofstream(path + ".new") << text;
+    std::rename((path + ".new").c_str(), path.c_str());
+}
+
+
+// Waits up to five seconds for the config to have the value at a
+bool waitForConfig(const dcf::LiveConfig &config, int64_t a) {
+    for(int i = 0; i < 500; i++) {
+        const dcf::Value *value = config.snapshot()->find("a");
+        if(value != nullptr && value->getType() == dcf::ValueType::INTEGER && value->asInt() == a) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+
+void testLiveConfig() {
+    const std::string path = "dcf-test-live.dcf";
+    writeConfig(path, "{a: 1, b: {c: 'x'}}");
+    checkThrows<std::runtime_error>([] { dcf::LiveConfig("dcf-test-missing.dcf"); }, "live config of a missing file");
+    {
+        dcf::LiveConfig config(path);
+        dcf::LiveConfig::Reader reader(config);
+        const std::shared_ptr<const dcf::Section> first = config.snapshot();
+        check(config.version() == 1 && first->get("a").asInt() == 1 && !config.lastError(), "initial snapshot");
+        check(&reader.get() == first.get(), "reader of the initial snapshot");
+
+        writeConfig(path, "{a: 2, b: {c: 'y'}}");
+        uint64_t version = config.version();
+        check(config.reload() && config.version() > version && !config.lastError(), "reload");
+        check(config.snapshot()->get("a").asInt() == 2 && reader.get().get("a").asInt() == 2, "reloaded snapshot");
+        check(first->get("b").asSection().get("c").asString() == "x", "held snapshot stays as it was");
+
+        // Broken files leave the last snapshot in place
+        writeConfig(path, "{a: 3, b: {c: }");
+        version = config.version();
+        const std::shared_ptr<const dcf::Section> good = config.snapshot();
+        check(!config.reload() && config.lastError() != nullptr, "reload of a broken file");
+        check(*config.snapshot() == dcf::parse("{a: 2, b: {c: 'y'}}") && reader.get() == *good, "broken file keeps the snapshot");
+        bool parseError = false;
+        try {
+            std::rethrow_exception(config.lastError());
+        } catch(const dcf::parse_error&) {
+            parseError = true;
+        }
+        check(parseError, "error of a broken file");
+
+#ifdef __linux__
+        // Writes to the file are picked up without reload, whichever way it is saved
+        check(config.watching(), "file is watched");
+        writeConfig(path, "{a: 4}");
+        check(waitForConfig(config, 4) && reader.get().get("a").asInt() == 4, "watched file written");
+        writeConfig(path, "{a: 5}", true);
+        check(waitForConfig(config, 5) && !config.lastError(), "watched file replaced");
+        writeConfig("dcf-test-other.dcf", "{a: 6}");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        check(config.snapshot()->get("a").asInt() == 5, "other files are ignored");
+        std::remove("dcf-test-other.dcf");
+#endif
+    }
+
+#ifdef __linux__
+    // With a single file descriptor left, the file can be read but not watched, and the
+    // config falls back on reload
+    rlimit limit;
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+    const int lowest = ::dup(0);
+    ::close(lowest);
+    rlimit low = limit;
+    low.rlim_cur = static_cast<rlim_t>(lowest + 1);
+    if(::setrlimit(RLIMIT_NOFILE, &low) == 0) {
+        bool fellBack = false;
+        try {
+            dcf::LiveConfig config(path);
+            writeConfig(path, "{a: 7}");
+            fellBack = !config.watching() && config.reload() && config.snapshot()->get("a").asInt() == 7;
+        } catch(const std::exception&) {
+        }
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+        check(fellBack, "live config without a watch");
+    }
+#endif
+    std::remove(path.c_str());
+}
+
+
+
+// user-020: edited documents match a parse of their whole text after every edit, however
+// much of them was parsed again, and report what changed
+
+void testIncremental() {
+    const std::string text = "{\n    // first\n    a: 1,\n    b: {c: [1, 2], d: 'x'},\n    e: [true, 'y'],\n    f: 2.5\n}";
+    dcf::IncrementalDocument document(text);
+    check(document.root() == dcf::parse(text) && document.text() == text, "incremental document");
+
+    const size_t c = text.find("2]");
+    check(document.edit(c, 1, "3") == std::vector<std::string>{"b.c[1]"}, "changed array element");
+    check(document.update(std::string(document.text()).replace(document.text().find("f: 2.5"), 6, "g: 'z'")) == std::vector<std::string>{"f", "g"}, "replaced pair");
+    // The header of a goes to the pair added before it
+    check(document.edit(document.text().find("a: 1"), 0, "h: [1],\n    ") == std::vector<std::string>{"a", "h"}, "added pair");
+    check(document.edit(document.text().find("e: [true, 'y'],"), 15, "").size() == 1, "removed pair");
+    check(document.root().toString() == dcf::parse(std::string(document.text())).toString(), "edits keep headers and order");
+
+    const std::string before(document.text());
+    checkThrows<dcf::parse_error>([&] { document.edit(document.text().find("h:"), 0, "{"); }, "broken edit");
+    check(document.text() == before && document.root() == dcf::parse(before), "broken edit leaves the document");
+
+    // Random edits of a larger document, with snippets that open and close comments,
+    // strings and brackets, add calls and duplicate keys
+    std::string large = "{\n";
+    for(int i = 0; i < 40; i++) {
+        large += "    // pair " + std::to_string(i) + "\n    k" + std::to_string(i) + ": {n: " + std::to_string(i) + ", list: [1, 'two', 3.5]},\n";
+    }
+    large += "    last: 0\n}";
+    dcf::IncrementalDocument edited(large);
+    const std::vector<std::string> snippets = {"", " ", ",", "x", "1", "'", "\"", "//", "/*", "*/", "\n", "{", "}", "[", "]",
+        "k3: 5,", "z: [1, 2],", "q: {r: 's'},", "@this(\"k1.n\")", "k7"};
+    std::mt19937 random(2);
+    bool same = true;
+    for(int i = 0; i < 3000 && same; i++) {
+        std::string text(edited.text());
+        const size_t offset = random() % (text.size() + 1);
+        const size_t length = random() % 4 == 0 ? random() % 12 : 0;
+        const std::string &replacement = snippets[random() % snippets.size()];
+        text.replace(offset, std::min(length, text.size() - offset), replacement);
+
+        std::optional<dcf::Section> expected;
+        try {
+            expected.emplace(dcf::parse(text));
+        } catch(const dcf::parse_error&) {
+        }
+
+        const dcf::Section previous = edited.root();
+        const std::string previousText(edited.text());
+        try {
+            const std::vector<std::string> changes = edited.edit(offset, length, replacement);
+            std::vector<std::string> expectedChanges;
+            for(const dcf::PatchOperation &operation : dcf::diff(previous, *expected)) {
+                expectedChanges.push_back(operation.path);
+            }
+            same = expected && edited.text() == text && edited.root() == *expected && changes == expectedChanges
+                && edited.root().toString() == expected->toString();
+        } catch(const dcf::parse_error&) {
+            same = !expected && edited.text() == previousText && edited.root() == previous;
+        }
+        // Keep the document from falling apart completely
+        if(i % 100 == 99) {
+            edited.update(large);
+        }
+    }
+    check(same, "random edits match a parse of the whole");
+}
+
+
+
+// user-021: copies share their sections and arrays until they are changed, then only what
+// lies on the way to the change is copied, into the memory resource of the copy
+
+// Counts the bytes allocated through it
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t allocated = 0;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        allocated += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *pointer, size_t bytes, size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+
+void testCopyOnWrite() {
+    const dcf::Section original = dcf::parse(DOCUMENT);
+    dcf::Section copy = original;
+    const dcf::Section &server = original.get("server").asSection();
+    check(&copy.get("server").asSection() == &server, "copies share their sections");
+
+    copy.set("version", int64_t(4));
+    copy.remove("name");
+    check(original == dcf::parse(DOCUMENT) && original.get("version").asInt() == 3 && copy.find("name") == nullptr, "changing a copy leaves the original");
+    check(&copy.get("server").asSection() == &server, "unchanged sections stay shared");
+
+    // Changing something nested copies the sections on the way there
+    dcf::Section nested = original;
+    dcf::Section changedServer = nested.get("server").asSection();
+    changedServer.set("host", std::string("remote"));
+    nested.set("server", std::move(changedServer));
+    check(original.get("server").asSection().get("host").asString() == "localhost", "changing a copied section leaves the original");
+    check(&nested.get("server").asSection().get("limits").asSection() == &server.get("limits").asSection(), "sections below the change stay shared");
+
+    dcf::Section patched = original;
+    dcf::apply(patched, {{dcf::PatchOperation::Kind::REPLACE, "server.ports[1]", dcf::Value(int64_t(8443))}});
+    check(patched.get("server").asSection().get("ports").asIntArray()[1] == 8443 && server.get("ports").asIntArray()[1] == 443, "changing a shared array");
+    check(&patched.get("list") != &original.get("list") && patched.get("list") == original.get("list"), "patched copy");
+
+    // Copies into another memory resource and everything changed in them are allocated
+    // there, nothing goes to the default resource
+    CountingResource resource;
+    CountingResource fallback;
+    const dcf::Value added(std::vector<dcf::Value>{int64_t(1), std::string("x")});
+    const dcf::Patch patch = {{dcf::PatchOperation::Kind::REPLACE, "server.limits.connections", dcf::Value(int64_t(5))}};
+    std::pmr::memory_resource *previous = std::pmr::set_default_resource(&fallback);
+    {
+        dcf::Section inResource(original, &resource);
+        const size_t copied = resource.allocated;
+        inResource.set("added", added);
+        dcf::apply(inResource, patch);
+        dcf::Section copyInResource(inResource, &resource);
+        copyInResource.set("more", original.get("list"));
+        check(copied > 0 && resource.allocated > copied && inResource.get("server").asSection().get("limits").asSection().get("connections").asInt() == 5, "copy into another resource");
+    }
+    std::pmr::set_default_resource(previous);
+    check(fallback.allocated == 0, "nothing allocated in the default resource");
+}
+
+
+
+// user-022: fingerprints are equal for equal sections, whatever the order of their keys,
+// and change with every change made to them
+
+void testFingerprints() {
+    const dcf::Section section = dcf::parse(DOCUMENT);
+    check(section.fingerprint() == dcf::parse(DOCUMENT).fingerprint(), "equal sections have equal fingerprints");
+    check(dcf::parse("{a: 1, b: [2, 'x']}").fingerprint() == dcf::parse("{b: [2, 'x'], a: 1}").fingerprint(), "fingerprints don't depend on the order of keys");
+    check(dcf::parse("{a: [1, 2]}").fingerprint() != dcf::parse("{a: [2, 1]}").fingerprint(), "fingerprints depend on the order of elements");
+    check(dcf::parse("{a: [1, 2]}").fingerprint() != dcf::parse("{a: [1, 'x']}").fingerprint(), "fingerprints of packed and mixed arrays");
+    check(dcf::parse("{// header\n a: 1}").fingerprint() == dcf::parse("{a: 1}").fingerprint(), "headers are left out of fingerprints");
+    check(dcf::Value(std::vector<dcf::Value>{int64_t(1), int64_t(2)}).fingerprint() == dcf::parse("{a: [1, 2]}").get("a").fingerprint(), "packed and unpacked arrays");
+
+    // Every change made in place drops the fingerprints on the way to it, arrays included
+    for(const std::string &path : {std::string("ints[1]"), std::string("doubles[0]"), std::string("mixed[1]"), std::string("server.limits.timeout"), std::string("list[0].id")}) {
+        dcf::Section changed = section;
+        const uint64_t before = changed.fingerprint();
+        dcf::apply(changed, {{dcf::PatchOperation::Kind::REPLACE, path, dcf::Value(int64_t(-7))}});
+        const uint64_t after = changed.fingerprint();
+        check(after != before && after == dcf::loadBinary(dcf::toBinary(changed)).root().toSection().fingerprint() && changed != section, "fingerprint after changing " + path);
+        dcf::apply(changed, dcf::diff(changed, section));
+        check(changed.fingerprint() == before && changed == section, "fingerprint after changing " + path + " back");
+    }
+
+    dcf::Section changed = section;
+    const uint64_t before = changed.fingerprint();
+    changed.set("version", int64_t(4));
+    check(changed.fingerprint() != before, "fingerprint after setting a key");
+    changed.set("version", int64_t(3));
+    check(changed.fingerprint() == before, "fingerprint after setting a key back");
+    changed.remove("nothing");
+    check(changed.fingerprint() != before && changed != section, "fingerprint after removing a key");
+}
+
+
+
+// user-023: patches turn one section into the other, headers and the order of keys
+// included, and outlive the sections they were made from
+
+// A random section of a few keys from a small set, so that two of them have much in common
+dcf::Section randomSection(std::mt19937 &random, int depth) {
+    static const std::vector<std::string> headers = {"", "// one", "/* two */", "// three\n// lines"};
+    dcf::Section section;
+    const size_t count = random() % 6;
+    for(size_t i = 0; i < count; i++) {
+        const std::string key = "k" + std::to_string(random() % 8);
+        dcf::Value value(false);
+        switch(random() % (depth > 0 ? 6 : 4)) {
+            case 0: value = dcf::Value(int64_t(random() % 3)); break;
+            case 1: value = dcf::Value(std::string(1, static_cast<char>('a' + random() % 3))); break;
+            case 2: value = dcf::Value(std::vector<dcf::Value>{int64_t(random() % 2), int64_t(1)}); break;
+            case 3: value = dcf::Value(random() % 2 == 0); break;
+            case 4: value = dcf::Value(std::vector<dcf::Value>{randomSection(random, depth - 1), int64_t(random() % 2)}); break;
+            default: value = dcf::Value(randomSection(random, depth - 1)); break;
+        }
+        section.set(key, std::move(value));
+        section.setHeader(key, headers[random() % headers.size()]);
+    }
+    return section;
+}
+
+
+void testDiff() {
+    const dcf::Section before = dcf::parse(DOCUMENT);
+    for(const std::string &text : {
+        std::string("{name: 'dcf', version: 3}"),
+        std::regex_replace(DOCUMENT, std::regex("header of the name"), "another header"),
+        std::regex_replace(DOCUMENT, std::regex("(version: 3,)(\\s*)(ratio: 0.25,)"), "$3$2$1"),
+        std::regex_replace(DOCUMENT, std::regex("server: \\{"), "// new\n    added: [1],\n    server: {\n        // nested\n"),
+        std::regex_replace(DOCUMENT, std::regex("\\{ id: 2"), "{\n // in an array\n id: 2")}) {
+        const dcf::Section after = dcf::parse(text);
+        dcf::Section patched = before;
+        dcf::apply(patched, dcf::diff(before, after));
+        check(patched == after && patched.toString() == after.toString(), "patch keeps headers and order for " + text.substr(0, 30));
+        check(before == dcf::parse(DOCUMENT), "patching a copy leaves the original");
+    }
+    check(dcf::diff(before, before).empty() && dcf::diff(before, dcf::parse(DOCUMENT)).empty(), "no changes");
+
+    // Paths are those of dcf::Path, and lead to the values in the section after the changes
+    dcf::Section after = before;
+    dcf::apply(after, {{dcf::PatchOperation::Kind::REPLACE, "server.ports[1]", dcf::Value(int64_t(8443))},
+        {dcf::PatchOperation::Kind::REPLACE, "list[1].ok", dcf::Value(true)},
+        {dcf::PatchOperation::Kind::SET, "server.limits.retries", dcf::Value(int64_t(3)), "// retries", 0},
+        {dcf::PatchOperation::Kind::HEADER, "version", dcf::Value(false), "// the version"},
+        {dcf::PatchOperation::Kind::REMOVE, "mixed", dcf::Value(false)}});
+    check(after.get("server").asSection().get("limits").asSection().keys().front() == "retries"
+        && after.getHeader("version") == "// the version" && after.find("mixed") == nullptr, "applying operations");
+    const dcf::Patch patch = dcf::diff(before, after);
+    std::vector<std::string> paths;
+    for(const dcf::PatchOperation &operation : patch) {
+        paths.push_back(operation.path);
+    }
+    check(paths == std::vector<std::string>{"version", "mixed", "server.ports[1]", "server.limits.retries", "list[1].ok"}, "patch paths");
+    check(patch[2].kind == dcf::PatchOperation::Kind::REPLACE && dcf::Path(patch[2].path).get(after) == patch[2].value, "patch paths are dcf::Paths");
+
+    checkThrows<std::runtime_error>([&] { dcf::apply(after, {{dcf::PatchOperation::Kind::REPLACE, "server.missing.a", dcf::Value(true)}}); }, "patch of a missing path");
+    checkThrows<std::runtime_error>([&] { dcf::apply(after, {{dcf::PatchOperation::Kind::REPLACE, "list[*].ok", dcf::Value(true)}}); }, "patch of a path with wildcards");
+    checkThrows<std::runtime_error>([&] { dcf::apply(after, {{dcf::PatchOperation::Kind::SET, "list[0]", dcf::Value(true)}}); }, "setting an element of an array");
+    checkThrows<std::runtime_error>([&] { dcf::apply(after, {{dcf::PatchOperation::Kind::REPLACE, "ints[4]", dcf::Value(true)}}); }, "element after the end of an array");
+
+    // Patches of documents are kept after the documents are gone
+    dcf::Patch kept;
+    {
+        dcf::Document first(DOCUMENT);
+        dcf::Document second(after.toString());
+        kept = dcf::diff(first.root(), second.root());
+    }
+    dcf::Section target = dcf::parse(DOCUMENT);
+    dcf::apply(target, kept);
+    check(target.toString() == dcf::parse(after.toString()).toString(), "patch outlives its documents");
+
+    std::mt19937 random(3);
+    bool same = true;
+    for(int i = 0; i < 2000 && same; i++) {
+        const dcf::Section first = randomSection(random, 2);
+        const dcf::Section second = randomSection(random, 2);
+        dcf::Section patched = first;
+        dcf::apply(patched, dcf::diff(first, second));
+        same = patched == second && patched.toString() == second.toString();
+    }
+    check(same, "patches between random sections");
+}
+
+
+
+// user-024: compiled paths find what walking the section finds, and their cached results
+// follow the section through every change and copy
+
+void testPaths() {
+    dcf::Section section = dcf::parse(DOCUMENT);
+    const dcf::Path port("server.ports[1]");
+    const dcf::Path timeout("server.limits.timeout");
+    const dcf::Path ids("list[*].id");
+
+    check(port.get(section).asInt() == 443 && timeout.get(section).asDouble() == 2.5, "path lookups");
+    check(port.get(section).asInt() == 443 && port.expression() == "server.ports[1]", "cached path lookup");
+    check(dcf::Path("ints[3]").get(section).asInt() == -4 && dcf::Path("mixed[4].five").get(section).asInt() == 5, "paths into arrays");
+    check(!dcf::Path("server.missing").find(section) && !dcf::Path("ints[9]").find(section) && !dcf::Path("name.a").find(section)
+        && !dcf::Path("ints[0].a").find(section) && !dcf::Path("server[0]").find(section), "paths that lead nowhere");
+    checkThrows<std::runtime_error>([&] { dcf::Path("server.missing").get(section); }, "get of a path that leads nowhere");
+
+    const auto found = ids.findAll(section);
+    check(found.size() == 2 && ids.get(section).asInt() == 1, "wildcard path");
+    check(dcf::Path("server.*").findAll(section).size() == 4 && dcf::Path("*.ports[*]").findAll(section).size() == 2, "wildcards for keys and elements");
+    check(dcf::Path("list[*].missing").findAll(section).empty() && !dcf::Path("list[*].missing").find(section), "wildcard path that leads nowhere");
+
+    for(const char *invalid : {"", "a..b", "a.", ".a", "a[", "a[x]", "a[-1]", "a[]", "[0]", "a]", "a[0]b"}) {
+        checkThrows<std::runtime_error>([&] { dcf::Path path(invalid); }, "invalid path " + std::string(invalid));
+    }
+
+    // Cached results follow the section as it is changed
+    dcf::Section server = section.get("server").asSection();
+    server.set("ports", std::vector<dcf::Value>{int64_t(1), int64_t(2)});
+    section.set("server", std::move(server));
+    check(port.get(section).asInt() == 2, "path after a write");
+    const dcf::Section copy = section;
+    section.remove("server");
+    check(!port.find(section) && port.get(copy).asInt() == 2, "path after a removal and on a copy");
+    section.set("server", dcf::parse("{ports: [7, 8, 9]}"));
+    check(port.get(section).asInt() == 8 && port.get(copy).asInt() == 2 && port.get(section).asInt() == 8, "path on sections taken in turns");
+    dcf::apply(section, {{dcf::PatchOperation::Kind::REPLACE, "server.ports[1]", dcf::Value(int64_t(80))}});
+    check(port.get(section).asInt() == 80, "path after a patch");
+
+    dcf::Path assigned("name");
+    assigned = port;
+    const dcf::Path copied = assigned;
+    check(assigned.get(section).asInt() == 80 && copied.get(copy).asInt() == 2, "copied paths");
+
+    // One path shared by threads that each evaluate it on sections of their own
+    std::vector<std::thread> threads;
+    // Not a std::vector<bool>, whose elements share bytes
+    std::vector<int> right(4, 1);
+    for(size_t t = 0; t < right.size(); t++) {
+        threads.emplace_back([&port, &right, t] {
+            dcf::Section own = dcf::parse("{server: {ports: [0, " + std::to_string(t) + "]}}");
+            for(int64_t i = 0; i < 2000; i++) {
+                if(i % 100 == 0) {
+                    own.set("server", dcf::parse("{ports: [0, " + std::to_string(t + 10 * i) + "]}"));
+                }
+                right[t] = right[t] && port.get(own).asInt() == static_cast<int64_t>(t) + 10 * (i - i % 100);
+            }
+        });
+    }
+    for(std::thread &thread : threads) {
+        thread.join();
+    }
+    check(right == std::vector<int>(4, 1), "path shared by threads");
+}
+
+
+
+// user-025: arrays of only integers, doubles or booleans are kept packed and viewed in
+// place, reading their elements builds values for that read alone
+
+void testPackedArrays() {
+    const dcf::Section section = dcf::parse(DOCUMENT);
+    const dcf::ArrayView<int64_t> ints = section.get("ints").asIntArray();
+    const dcf::ArrayView<double> doubles = section.get("doubles").asDoubleArray();
+    const dcf::ArrayView<uint8_t> bools = section.get("bools").asBoolArray();
+    check(ints.size() == 4 && ints[3] == -4 && ints.data() == section.get("ints").asIntArray().data(), "integers viewed in place");
+    check(doubles.size() == 3 && doubles[2] == 2.5 && bools.size() == 2 && bools[0] == 1 && bools[1] == 0, "doubles and booleans viewed in place");
+    check(section.get("empty").asIntArray().empty() && section.get("empty").asBoolArray().empty(), "empty arrays give empty views");
+    checkThrows<std::runtime_error>([&] { section.get("mixed").asIntArray(); }, "mixed array has no packed view");
+    checkThrows<std::runtime_error>([&] { section.get("ints").asBoolArray(); }, "integers have no boolean view");
+    checkThrows<std::runtime_error>([&] { section.get("bools").asValueArray(); }, "booleans have no value view");
+
+    const std::vector<dcf::Value> elements = section.get("bools").asArray();
+    check(elements.size() == 2 && elements[0].asBool() && !elements[1].asBool(), "packed booleans as values");
+    check(section.get("ints").asArray() == section.get("ints").asArray() && section.get("ints").asArray()[3].asInt() == -4, "packed integers as values");
+    const dcf::Value unpacked(std::vector<dcf::Value>{true, false});
+    check(unpacked == section.get("bools") && unpacked.asBoolArray().size() == 2, "arrays of booleans are packed however they are made");
+
+    // Nothing is kept of values built for reads, the array stays as small as it was
+    CountingResource resource;
+    const dcf::Section inResource(section, &resource);
+    const size_t copied = resource.allocated;
+    const dcf::Path element("ints[2]");
+    const dcf::Path all("bools[*]");
+    bool read = true;
+    for(int i = 0; i < 100; i++) {
+        read = read && element.get(inResource).asInt() == 3 && all.findAll(inResource).size() == 2
+            && inResource.get("doubles").asArray()[1].asDouble() == 1.5;
+    }
+    check(read && !dcf::Path("bools[2]").find(inResource) && !dcf::Path("ints[0].a").find(inResource), "paths into packed arrays");
+    check(resource.allocated == copied, "reading packed arrays allocates nothing");
+
+    // Elements of the packed type are set in place, others unpack the array
+    dcf::Section changed = section;
+    dcf::apply(changed, {{dcf::PatchOperation::Kind::REPLACE, "bools[1]", dcf::Value(true)},
+        {dcf::PatchOperation::Kind::REPLACE, "ints[0]", dcf::Value(std::string("x"))}});
+    check(changed.get("bools").asBoolArray()[1] == 1 && section.get("bools").asBoolArray()[1] == 0, "setting a packed boolean");
+    check(changed.get("ints").asValueArray()[0].asString() == "x" && changed.get("ints").asValueArray()[3].asInt() == -4, "setting an element that unpacks the array");
+    check(dcf::Path("ints[0]").get(changed).asString() == "x" && dcf::Path("ints[0]").get(section).asInt() == 1, "paths into an unpacked array");
+    dcf::apply(changed, {{dcf::PatchOperation::Kind::REPLACE, "ints[0]", dcf::Value(int64_t(1))}});
+    check(changed.get("ints").asIntArray()[0] == 1 && changed.get("ints") == section.get("ints"), "setting the last other element packs the array again");
+
+    // Packed booleans are written and read as booleans
+    const dcf::Section written = dcf::parse(section.toString());
+    check(written.get("bools").asBoolArray()[0] == 1 && written.get("bools") == section.get("bools"), "packed booleans written and read");
+    const std::string data = dcf::toBinary(section);
+    const dcf::Section binary = dcf::loadBinary(data).root().toSection();
+    check(binary.get("bools").asBoolArray()[1] == 0 && binary.get("doubles") == section.get("doubles") && binary == section, "packed arrays in binary");
+}
+
+
+
 int main() {
     std::string fullFile;
     readFile("test/simple.dcf", fullFile);
@@ -26,5 +1422,36 @@ int main() {
     dcf::Section config = dcf::parse(fullFile);
     std::cout << config.toString() << std::endl;
 
+    testParseFile(fullFile);
+    testLexer(fullFile);
+    testLookahead();
+    testScanning();
+    testDocument();
+    testMoves();
+    testSectionStorage();
+    testKeys();
+    testLazyParsing(fullFile);
+    testThreadedParsing();
+    testNesting();
+    testNumbers();
+    testWriter();
+    testBinary();
+    testHandler(fullFile);
+    testBinding();
+    testFunctions();
+    testLiveConfig();
+    testIncremental();
+    testCopyOnWrite();
+    testFingerprints();
+    testDiff();
+    testPaths();
+        testPackedArrays();
+
+    if(failures > 0) {
+        std::cout << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+
     return 0;
 }